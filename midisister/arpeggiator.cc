@@ -0,0 +1,157 @@
+#include "arpeggiator.h"
+#include "ext_clock.h"
+#include "midi_scheduler.h"
+
+#include <algorithm>
+#include <iterator>
+
+
+namespace {
+
+uint32_t roundUpTo(uint32_t val, uint32_t multiple)
+{
+    return val + (multiple - val % multiple) % multiple;
+}
+
+}
+
+
+void Arpeggiator::start(uint32_t nowUs)
+{
+    m_playing = true;
+    m_step = 0;
+    m_nextUs = nowUs;
+    m_nextFracQ8 = 0;
+    // picked up by the first update
+    m_onTicks = false;
+    m_nextTick = 0;
+    m_lastDueUs = nowUs;
+    m_random ^= nowUs;
+}
+
+void Arpeggiator::stop(MidiScheduler& scheduler, uint32_t nowUs)
+{
+    if (!m_playing)
+        return;
+    m_playing = false;
+
+    // a note whose off was dropped is still sounding; one whose on went too just gets a spare off
+    scheduler.cancelTimed();
+    for (Sounding& sounding : m_sounding)
+    {
+        if (sounding.note && int32_t(sounding.offUs - nowUs) > 0)
+            scheduler.noteOff(sounding.channel, sounding.note);
+        sounding = {};
+    }
+}
+
+void Arpeggiator::onTicksChanged(const Config& config, const ExtClock* clock, uint32_t nowUs)
+{
+    m_onTicks = (clock != nullptr);
+    if (m_onTicks)
+    {
+        m_nextTick = roundUpTo(clock->getTicks(), config.getAutoRepeatTicks());
+        return;
+    }
+
+    // carry on at BPM from the last step, if it's not gone by already
+    const uint32_t stepUs = uint32_t(config.getStepUsQ8() >> 8);
+    m_nextUs = (m_step && int32_t(m_lastDueUs + stepUs - nowUs) > 0) ? m_lastDueUs + stepUs : nowUs;
+    m_nextFracQ8 = 0;
+}
+
+uint Arpeggiator::pickOffset(const Config& config, fixed joy)
+{
+    const uint span = config.getArpSpan();
+    switch (config.getArpMode())
+    {
+        case ArpMode::Down:
+            return span - 1 - (m_step % span);
+
+        case ArpMode::Random:
+            // xorshift32
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 17;
+            m_random ^= m_random << 5;
+            return m_random % span;
+
+        case ArpMode::Joystick:
+        {
+            const fixed pos = std::clamp<fixed>(joy, -FixedOne, FixedOne) + FixedOne;
+            return uint((int64_t(pos) * (span - 1) + FixedOne) / (2 * FixedOne));
+        }
+
+        default:
+            return m_step % span;
+    }
+}
+
+bool Arpeggiator::update(MidiScheduler& scheduler, const Config& config, const ExtClock* clock,
+                         uint baseIx, fixed joy, uint32_t nowUs, uint32_t minLeadUs)
+{
+    if (!m_playing || config.getArpMode() == ArpMode::Off)
+        return false;
+
+    if ((clock != nullptr) != m_onTicks)
+        onTicksChanged(config, clock, nowUs);
+
+    // a tick's worth of lead, going by whichever tempo's in charge
+    uint32_t dueUs, stepUs, tickUs;
+    if (m_onTicks)
+    {
+        // a step that was missed altogether (the clock jumped, or the loop stalled) is skipped
+        const uint ticksPerStep = config.getAutoRepeatTicks();
+        if (int32_t(m_nextTick - clock->getTicks()) < 0)
+            m_nextTick = roundUpTo(clock->getTicks(), ticksPerStep);
+
+        dueUs = clock->getTickTimeUs(m_nextTick);
+        tickUs = clock->getTickUs();
+        stepUs = ticksPerStep * tickUs;
+    }
+    else
+    {
+        const uint64_t stepQ8 = config.getStepUsQ8();
+        dueUs = m_nextUs;
+        stepUs = uint32_t(stepQ8 >> 8);
+        tickUs = stepUs / std::max(config.getAutoRepeatTicks(), 1u);
+        if (int32_t(nowUs - dueUs) > int32_t(stepUs))
+        {
+            m_nextUs = dueUs = nowUs;
+            m_nextFracQ8 = 0;
+        }
+    }
+
+    if (int32_t(dueUs - nowUs) > int32_t(std::max(tickUs, minLeadUs)))
+        return false;
+
+    const byte channel = config.getChannel();
+    const byte note = config.getNoteForIndex(baseIx + pickOffset(config, joy));
+    const uint32_t gateUs = std::max<uint32_t>(uint64_t(stepUs) * config.getArpGatePct() / 100, 1);
+    scheduler.noteOnAt(dueUs, channel, note);
+    scheduler.noteOffAt(dueUs + gateUs, channel, note);
+
+    // into a slot whose off has gone; there's always one, unless an off was dropped, in which
+    // case that note's hanging anyway and the oldest slot is as good as any
+    uint slot = (m_lastSounding + 1) % std::size(m_sounding);
+    for (uint i=0; i<std::size(m_sounding); ++i, slot=(slot + 1) % std::size(m_sounding))
+    {
+        if (!m_sounding[slot].note || int32_t(m_sounding[slot].offUs - nowUs) <= 0)
+            break;
+    }
+    m_lastSounding = slot;
+    m_sounding[slot] = { channel, note, dueUs + gateUs };
+
+    ++m_step;
+    m_lastDueUs = dueUs;
+    if (m_onTicks)
+    {
+        m_nextTick += config.getAutoRepeatTicks();
+    }
+    else
+    {
+        const uint64_t nextQ8 = m_nextFracQ8 + config.getStepUsQ8();
+        m_nextUs += uint32_t(nextQ8 >> 8);
+        m_nextFracQ8 = uint32_t(nextQ8 & 0xff);
+    }
+    return true;
+}
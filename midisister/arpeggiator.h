@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include "config.h"
+#include "midi.h"
+#include "util.h"
+
+class ExtClock;
+class MidiScheduler;
+
+
+// plays the config's ARP pattern over its scale while Z is held, a step every DIV beats: at BPM,
+// or on an incoming clock's ticks once it's locked & running
+// each step's note on & off are queued together on midi's timer about a clock tick before the
+// step's due, so they go out on time whatever the loop's up to; the note's only picked then, so
+// the pattern follows the mapped note (and the joystick) as they move
+class Arpeggiator
+{
+public:
+    bool isPlaying() const      { return m_playing; }
+
+    // the first step's due straight away, or on the next step's worth of ticks with a clock
+    void start(uint32_t nowUs);
+    // drops any steps that haven't gone yet and lets go of whatever's still sounding
+    void stop(MidiScheduler& scheduler, uint32_t nowUs);
+
+    // queues the next step once it's close enough; true if it did
+    //  baseIx is the mapped note's place in the scale, and joy the joystick's x for ArpMode::Joystick
+    //  clock is what to follow, if anything; minLeadUs is how far ahead the step has to be queued
+    //  for the loop not to miss it
+    bool update(MidiScheduler& scheduler, const Config& config, const ExtClock* clock,
+                uint baseIx, fixed joy, uint32_t nowUs, uint32_t minLeadUs);
+
+private:
+    uint pickOffset(const Config& config, fixed joy);
+    void onTicksChanged(const Config& config, const ExtClock* clock, uint32_t nowUs);
+
+    // every step's note until its off has gone; with a long gate, or a short step, that can be
+    // many steps back, but never more than the offs that fit on midi's timer
+    struct Sounding
+    {
+        byte     channel;
+        byte     note;      // 0 => none
+        uint32_t offUs;
+    };
+
+    bool     m_playing = false;
+    bool     m_onTicks = false;     // following a clock
+    uint32_t m_step = 0;
+    uint32_t m_nextUs = 0;          // when the next step's due, to 1/256us, going by BPM
+    uint32_t m_nextFracQ8 = 0;
+    uint32_t m_nextTick = 0;        // or the tick it's due on, going by a clock
+    uint32_t m_lastDueUs = 0;
+    uint32_t m_random = 0x2545f491;
+
+    Sounding m_sounding[MidiMaxTimedMessages] = {};
+    uint     m_lastSounding = 0;
+};
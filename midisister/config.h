@@ -1,10 +1,10 @@
 #pragma once
 
-#include "util.h"
-#include <vector>
-
+#include <algorithm>
 
-class Nunchuk;
+#include "midi.h"
+#include "nunchuk.h"
+#include "util.h"
 
 
 enum class Key : uint8_t
@@ -25,6 +25,25 @@ enum class Dest : uint8_t
     ControlChange,
     PitchBend,
     Note,
+    ControlChange14,    // msb on cc n, lsb on cc n + 32
+    Nrpn,
+};
+
+// where auto repeat's timing comes from
+enum class Sync : uint8_t
+{
+    Internal,   // BPM & DIV
+    External,   // incoming midi clock; repeats land every DIV beats' worth of its ticks
+};
+
+// the order an arpeggio walks its notes in; see ARP
+enum class ArpMode : uint8_t
+{
+    Off,
+    Up,
+    Down,
+    Random,
+    Joystick,   // jx picks each step's note, left to right
 };
 
 struct Mapping
@@ -33,42 +52,121 @@ struct Mapping
     Dest destType = Dest::ControlChange;
     uint16_t destParam = 1;
 
-    float fromLo = -1.0f;
-    float fromHi = 1.0f;
+    fixed fromLo = -FixedOne;
+    fixed fromHi = FixedOne;
     uint16_t toLo = 0;
     uint16_t toHi = 127;
 
+    uint16_t maxRate = 0;       // messages per second; 0 => unlimited
+    uint16_t emaAlpha = 256;    // weight of each new raw sample, /256; 256 => unfiltered
+    uint16_t hysteresis = 0;    // output has to move at least this far before it's resent
+
+    // NB. the main loop reads these through MappingLuts & Config::Runtime; this is the reference path they're built from
     uint16_t getVal(const Nunchuk& nchk) const;
+    uint16_t remap(fixed axisVal) const;
+    Nunchuk::Axis getAxis() const;
+    constexpr uint32_t getMinIntervalUs() const   { return maxRate ? (1000 * 1000) / maxRate : 0; }
 };
 
 
 // config description looks like:
 // CHAN 1 ROOT C SCALE 0 0 0 1 5 7 11 OCTAVES 2 7 BPM 100 DIV 0.5 MAP ax -1 1 36 100 note MAP jx- cc 16 MAP jx+ cc 19 MAP jy pb MAP ay cc 17 MAP az 1 -1 0 127 cc 18
+//
+// as well as cc, pb & note, a mapping can go to a 14 bit destination; both default to the full 0..16383:
+//   cc14 <n>       msb on cc n (0-31), lsb on cc n+32
+//   nrpn <n>       nrpn n (0-16383), through data entry msb & lsb
+//
+// mappings can be followed by lowercase modifiers:
+//   limit <n>      send at most n messages per second
+//   ema <a>        smooth the raw input with an exponential moving average; a in (0,1], smaller is smoother
+//   hyst <n>       ignore output changes smaller than n (the ends of the range always get through)
+//
+// DIV <beats> is how far apart C+Z auto repeats (and arp steps) are; no less than a clock tick, 1/24
+// RATE <hz> samples the nunchuk on a fixed clock; 0 (the default) reads it as fast as it'll go
+// PORTS <port>... sends midi out of just those ports, from din & usb; the default is both
+// THRU on|off merges whatever comes in on the din input into the din output; off by default
+// SYNC int|ext times C+Z auto repeat from BPM (int, the default) or the incoming midi clock (ext)
+// CLOCK on|off sends midi clock at BPM; the console's clock command starts & stops it. off by default
+// ARP up|down|random|joy|off [span <n>] [gate <pct>] plays an arpeggio while Z is held instead of a
+//   single note: a step every DIV beats (timed like auto repeat, so SYNC applies), over the n scale
+//   notes from the mapped one up (4 by default), each held for pct% of the step (50). off by default
 
 class Config
 {
 public:
-    using Notes = std::vector<byte>;
     static const uint MaxMappings = 10;
-
-    bool parse(const char* config);
-
-    bool areNotesEnabled() const        { return notesMapping != nullptr; }
+    // configs are saved to flash as a straight copy of this object; bump this whenever its layout
+    // changes so that old saves get re-parsed from their text instead
+    static constexpr uint16_t ImageVersion = 6;
+    // a clock tick; nothing finer can follow SYNC ext
+    static constexpr float MinDivision = 1.f / 24;
+
+    // the parts of the mappings that the per-frame loop touches, one array per field so it walks
+    // them in order rather than striding over the parse-time descriptions
+    struct Runtime
+    {
+        Dest     destType[MaxMappings];
+        uint16_t destParam[MaxMappings];
+        uint16_t toLo[MaxMappings];
+        uint16_t toHi[MaxMappings];
+        uint16_t emaAlpha[MaxMappings];
+        uint16_t hysteresis[MaxMappings];
+        uint32_t minIntervalUs[MaxMappings];
+
+        constexpr void set(uint ix, const Mapping& mapping);
+    };
+
+    // fails if the config's invalid, leaving whatever was parsed up to that point
+    constexpr bool parse(const char* config);
+    // the same a piece at a time (eg. each line as it arrives), so no one call takes long. parse()
+    // is just beginParse(), parseMore() on the whole text, then endParse()
+    constexpr void beginParse();
+    constexpr bool parseMore(const char* text);
+    constexpr void endParse();
+    // for the configs built into the firmware; any mistake in them fails the build
+    static constexpr Config fromText(const char* config);
+
+    bool areNotesEnabled() const        { return notesMappingIx >= 0; }
     uint8_t getMappedNote(const Nunchuk& nchk) const;
+    uint8_t getNoteForIndex(uint noteIx) const;
+    // the place in the scale of the note at or below it
+    uint getNoteIndex(uint8_t note) const;
+    const Mapping* getNotesMapping() const  { return areNotesEnabled() ? &mappings[notesMappingIx] : nullptr; }
     byte quantiseNote(uint16_t incoming) const;
 
     byte getChannel() const             { return channel; }
+    uint getBpm() const                 { return bpm; }
     uint32_t getAutoRepeatMs() const    { return autoRepeatMs; }
+    Sync getSync() const                { return sync; }
+    // DIV at BPM, to 1/256us
+    uint64_t getStepUsQ8() const        { return stepUsQ8; }
+    // DIV in midi clock ticks, at 24 to the beat
+    uint getAutoRepeatTicks() const     { return autoRepeatTicks; }
+    uint getSampleRateHz() const        { return sampleRateHz; }
+    uint8_t getOutputPorts() const      { return outputPorts; }
+    bool isThruEnabled() const          { return thru; }
+    bool isClockOutEnabled() const      { return clockOut; }
+    ArpMode getArpMode() const          { return arpMode; }
+    uint getArpSpan() const             { return arpSpan; }
+    uint getArpGatePct() const          { return arpGatePct; }
 
     const Mapping* getMappings() const  { return mappings; }
     uint getNumMappings() const         { return numMappings; }
+    const Runtime& getRuntime() const   { return runtime; }
 
 private:
-    void parseScale(const char*& str);
-    void refreshScaleNotes();
+    constexpr void reset();
+    constexpr void parseScale(const char*& str);
+    constexpr void parsePorts(const char*& str);
+    constexpr void parseArp(const char*& str);
+    constexpr void refreshScaleNotes();
+    constexpr void refreshTiming();
 
 private:
     static constexpr uint MaxScaleNotes = 16;
+    // midi notes only go up to octave 10
+    static constexpr uint MaxOctaves = 11;
+    static constexpr uint MaxValidNotes = MaxScaleNotes * MaxOctaves;
 
     byte channel = 1;   // 0-f  =>  1-16
 
@@ -79,12 +177,30 @@ private:
     byte firstOctave = 2;
     byte lastOctave = 7;
     float division = 0.5f;
+    uint16_t sampleRateHz = 0;
+    uint8_t outputPorts = MidiPort_All;
+    bool thru = false;
+    Sync sync = Sync::Internal;
+    bool clockOut = false;
+    ArpMode arpMode = ArpMode::Off;
+    byte arpSpan = 4;
+    byte arpGatePct = 50;
     
     Mapping mappings[MaxMappings] = {};
     byte numMappings = 0;
 
     // computed based on the above
-    Notes validNotes;
+    byte validNotes[MaxValidNotes] = {};
+    byte numValidNotes = 0;
     uint32_t autoRepeatMs = 250;
-    const Mapping* notesMapping = nullptr;
+    uint16_t autoRepeatTicks = 12;
+    uint64_t stepUsQ8 = 300 * 1000 * 256;
+    int8_t notesMappingIx = -1;
+    Runtime runtime = {};
 };
+
+// the whole thing is static & copied around whole, so keep an eye on it
+static_assert(sizeof(Config) <= 768, "Config has grown; check it still wants to live in ram");
+
+
+#include "config_parse.h"
@@ -0,0 +1,737 @@
+#pragma once
+
+// the config parser; it's all constexpr so that the configs built into the firmware are parsed by
+// the compiler, which means it has to live in a header. only config.h should include this
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+
+
+//                       _
+//  _ __   __ _ _ __ ___(_)_ __   __ _
+// | '_ \ / _` | '__/ __| | '_ \ / _` |
+// | |_) | (_| | |  \__ \ | | | | (_| |
+// | .__/ \__,_|_|  |___/_|_| |_|\__, |
+// |_|                           |___/
+//
+
+namespace config_parse {
+
+// deliberately not constexpr; reaching it while the compiler's parsing a built-in config is what
+// turns a bad config into a build error, and the error names this function
+void built_in_config_is_invalid(const char* why);
+
+constexpr void error(const char* msg)
+{
+    if (std::is_constant_evaluated())
+    {
+        // msg is never null; without some path through that's constant, gcc rejects the function outright
+        if (msg)
+            built_in_config_is_invalid(msg);
+    }
+    else
+    {
+        onError();
+        puts(msg);
+    }
+}
+
+constexpr bool isSpace(char c)  { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool isDigit(char c)  { return c >= '0' && c <= '9'; }
+constexpr bool isAlpha(char c)  { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+constexpr char toLower(char c)  { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+// the rest of the word at str, for error messages
+constexpr int wordLen(const char* str)
+{
+    int len = 0;
+    while (str[len] && !isSpace(str[len]))
+        ++len;
+    return len;
+}
+
+// like error(), but shows the offending word too
+constexpr void errorAt(const char* msg, const char* at)
+{
+    if (!std::is_constant_evaluated())
+        printf("%s '%.*s'\n", msg, wordLen(at), at);
+    error(msg);
+}
+
+constexpr void skipToWs(const char*& curr)
+{
+    while (*curr && !isSpace(*curr))
+        ++curr;
+}
+constexpr void skipWs(const char*& curr)
+{
+    while (*curr && isSpace(*curr))
+        ++curr;
+}
+
+// the same as strtol, as far as the config needs: leading space, a sign and decimal digits
+// nothing is consumed if there's no number there
+template<typename T>
+constexpr T parseIntegral(const char* start, const char** outEnd)
+{
+    const char* curr = start;
+    skipWs(curr);
+
+    bool negative = false;
+    if (*curr == '-' || *curr == '+')
+    {
+        negative = (*curr == '-');
+        ++curr;
+    }
+
+    if (!isDigit(*curr))
+    {
+        *outEnd = start;
+        return T(0);
+    }
+
+    // saturates well outside anything that'd fit, so the range check below still catches it
+    int parsed = 0;
+    for (; isDigit(*curr); ++curr)
+        parsed = std::min(parsed * 10 + (*curr - '0'), 1 << 24);
+    if (negative)
+        parsed = -parsed;
+    *outEnd = curr;
+
+    T val = T(parsed);
+    if (parsed != int(val))
+    {
+        error("ERR: out of range integral");
+        return T(std::clamp<int>(parsed, std::numeric_limits<T>::min(), std::numeric_limits<T>::max()));
+    }
+    return val;
+}
+
+constexpr byte parseByte(const char* start, const char** outEnd)   { return parseIntegral<byte>(start, outEnd); }
+constexpr uint16_t parseUShort(const char* start, const char** outEnd)   { return parseIntegral<uint16_t>(start, outEnd); }
+
+// plain decimals, eg. -1, 0.25, .5; no exponents
+constexpr float parseFloat(const char*& curr)
+{
+    const char* start = curr;
+    skipWs(curr);
+
+    bool negative = false;
+    if (*curr == '-' || *curr == '+')
+    {
+        negative = (*curr == '-');
+        ++curr;
+    }
+
+    bool anyDigits = false;
+    float val = 0.f;
+    for (; isDigit(*curr); ++curr)
+    {
+        val = val * 10.f + float(*curr - '0');
+        anyDigits = true;
+    }
+
+    if (*curr == '.')
+    {
+        ++curr;
+
+        // keep the fraction as an integer and divide once, so 0.1 comes out as close as strtof gets it
+        uint32_t frac = 0;
+        float scale = 1.f;
+        for (; isDigit(*curr); ++curr)
+        {
+            if (scale < 1e9f)
+            {
+                frac = frac * 10 + uint32_t(*curr - '0');
+                scale *= 10.f;
+            }
+            anyDigits = true;
+        }
+        val += float(frac) / scale;
+    }
+
+    if (!anyDigits)
+    {
+        curr = start;
+        return 0.f;
+    }
+
+    return negative ? -val : val;
+}
+
+constexpr Key parseKey(const char*& str)
+{
+    Key key = Key::C;
+
+    skipWs(str);
+    switch(*str)
+    {
+        case 'A': case 'a': key = Key::A; break;
+        case 'B': case 'b': key = Key::B; break;
+        case 'C': case 'c': key = Key::C; break;
+        case 'D': case 'd': key = Key::D; break;
+        case 'E': case 'e': key = Key::E; break;
+        case 'F': case 'f': key = Key::F; break;
+        case 'G': case 'g': key = Key::G; break;
+
+        default:
+            errorAt("invalid key", str);
+            return Key::C;
+    }
+
+    ++str;
+    if (*str == 'b')
+        key = Key((uint(key) + 12 - 1) % 12);
+    else if (*str == '#')
+        key = Key((uint(key) + 1) % 12);
+    else if (*str && !isSpace(*str))
+        errorAt("invalid key", str - 1);
+
+    return key;
+}
+
+// whether the word at str is this one, ignoring case; word has to be lowercase
+constexpr bool isWord(const char* str, const char* word)
+{
+    uint len = 0;
+    for (; word[len]; ++len)
+    {
+        if (toLower(str[len]) != word[len])
+            return false;
+    }
+    return !str[len] || isSpace(str[len]);
+}
+
+// consumes the word if it's next
+constexpr bool matchModifier(const char*& curr, const char* word)
+{
+    const char* start = curr;
+    skipWs(start);
+
+    uint len = 0;
+    for (; word[len]; ++len)
+    {
+        if (start[len] != word[len])
+            return false;
+    }
+    if (start[len] && !isSpace(start[len]))
+        return false;
+
+    curr = start + len;
+    return true;
+}
+
+constexpr Input parseJoystick(const char*& curr, Input fullAxis, Input neg, Input pos)
+{
+    ++curr;
+    char mod = *curr;
+    if (!mod || isSpace(mod))
+        return fullAxis;
+
+    skipToWs(curr);
+    if (mod == '+')
+        return pos;
+    else if (mod == '-')
+        return neg;
+
+    error("ERR: invalid joystick");
+    return fullAxis;
+}
+
+constexpr Input parseInput(const char*& curr)
+{
+    skipWs(curr);
+    if (!*curr)
+    {
+        error("ERR: null input");
+        skipToWs(curr);
+        return Input::AccelX;
+    }
+
+    switch(*curr)
+    {
+        case 'A': case 'a':
+        {
+            ++curr;
+            char axis = *curr;
+            ++curr;
+            switch (axis)
+            {
+                case 'X': case 'x': return Input::AccelX;
+                case 'Y': case 'y': return Input::AccelY;
+                case 'Z': case 'z': return Input::AccelZ;
+            }
+            error("ERR: invalid accel input");
+            skipToWs(curr);
+            return Input::AccelX;
+        }
+
+        case 'J': case 'j':
+            ++curr;
+            switch(*curr)
+            {
+                case 'X': case 'x': return parseJoystick(curr, Input::JoyX, Input::JoyXNeg, Input::JoyXPos);
+                case 'Y': case 'y': return parseJoystick(curr, Input::JoyY, Input::JoyYNeg, Input::JoyYPos);
+            }
+            error("ERR: unknown joystick input");
+            skipToWs(curr);
+            return Input::JoyX;
+    }
+
+    error("ERR: unknown input");
+    skipToWs(curr);
+    return Input::AccelX;
+}
+
+constexpr void parseMapping(Mapping& mapping, const char*& curr, uint8_t numScaleNotes)
+{
+#define BAIL_ON_EOS     if (!*curr) { error("ERR: unexpected end"); return; }
+
+    mapping.input = parseInput(curr);
+    skipWs(curr);   BAIL_ON_EOS;
+
+    // optional remap values
+    bool useDefaultRemap = true;
+    if (!isAlpha(*curr))
+    {
+        useDefaultRemap = false;
+        mapping.fromLo = fixed_from_float(parseFloat(curr)); BAIL_ON_EOS;
+        mapping.fromHi = fixed_from_float(parseFloat(curr)); BAIL_ON_EOS;
+        mapping.toLo = parseUShort(curr, &curr); BAIL_ON_EOS;
+        mapping.toHi = parseUShort(curr, &curr); BAIL_ON_EOS;
+    }
+    else
+    {
+        mapping.fromLo = -FixedOne;
+        mapping.fromHi = FixedOne;
+
+        if (mapping.input == Input::JoyXNeg || mapping.input == Input::JoyXPos ||
+            mapping.input == Input::JoyYNeg || mapping.input == Input::JoyYPos)
+        {
+            mapping.fromLo = 0;
+        }
+
+        mapping.toLo = 0;
+        mapping.toHi = 127;
+    }
+
+    skipWs(curr); BAIL_ON_EOS;
+    // the destination can be the last thing there is, eg. when the config's parsed a line at a time
+    const char* destStart = curr;
+    skipToWs(curr);
+    switch(*destStart)
+    {
+        case 'C': case 'c':     // cc, cc14
+            if (isWord(destStart, "cc14"))
+            {
+                // the lsb goes out on cc + 32, so only the lower 32 have a pair
+                mapping.destType = Dest::ControlChange14;
+                mapping.destParam = parseByte(curr, &curr);
+                if (mapping.destParam >= 32)
+                {
+                    errorAt("cc14 needs a cc below 32", destStart);
+                    return;
+                }
+                if (useDefaultRemap)
+                    mapping.toHi = 16383;
+                break;
+            }
+            mapping.destType = Dest::ControlChange;
+            mapping.destParam = parseByte(curr, &curr);
+            break;
+
+        case 'P': case 'p':     // pb
+            mapping.destType = Dest::PitchBend;
+            if (useDefaultRemap)
+                mapping.toHi = 16383;
+            break;
+
+        case 'N': case 'n':     // note, nrpn
+            if (isWord(destStart, "nrpn"))
+            {
+                mapping.destType = Dest::Nrpn;
+                mapping.destParam = parseUShort(curr, &curr);
+                if (mapping.destParam > 16383)
+                {
+                    errorAt("nrpn number out of range", destStart);
+                    return;
+                }
+                if (useDefaultRemap)
+                    mapping.toHi = 16383;
+                break;
+            }
+            mapping.destType = Dest::Note;
+            if (useDefaultRemap && numScaleNotes > 0)
+            {
+                mapping.toLo = 0;
+                mapping.toHi = numScaleNotes - 1;
+                if (!std::is_constant_evaluated())
+                    printf("  .. remapping note input to [%d,%d]\n", int(mapping.toLo), int(mapping.toHi));
+            }
+            break;
+
+        default:
+            errorAt("unknown destination", destStart);
+            return;
+    }
+
+    // optional modifiers; these are all lowercase so they can't be mistaken for the next command
+    for (;;)
+    {
+        if (matchModifier(curr, "limit"))
+        {
+            mapping.maxRate = parseUShort(curr, &curr);
+        }
+        else if (matchModifier(curr, "ema"))
+        {
+            float alpha = std::clamp(parseFloat(curr), 0.f, 1.f);
+            mapping.emaAlpha = std::max<uint16_t>(uint16_t(alpha * 256.f + 0.5f), 1);
+        }
+        else if (matchModifier(curr, "hyst"))
+        {
+            mapping.hysteresis = parseUShort(curr, &curr);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+#undef BAIL_ON_EOS
+}
+
+}   // namespace config_parse
+
+
+constexpr void Config::parseScale(const char*& curr)
+{
+    using namespace config_parse;
+
+    numScaleNotes = 0;
+    skipWs(curr);
+
+    while(isDigit(*curr) && numScaleNotes < MaxScaleNotes)
+    {
+        scaleNotes[numScaleNotes] = parseByte(curr, &curr);
+        ++numScaleNotes;
+        skipWs(curr);
+    }
+}
+
+constexpr void Config::parsePorts(const char*& curr)
+{
+    using namespace config_parse;
+
+    outputPorts = 0;
+    for (;;)
+    {
+        if (matchModifier(curr, "din"))
+            outputPorts |= MidiPort_Din;
+        else if (matchModifier(curr, "usb"))
+            outputPorts |= MidiPort_Usb;
+        else
+            break;
+    }
+
+    if (!outputPorts)
+    {
+        skipWs(curr);
+        errorAt("expected din and/or usb", curr);
+    }
+}
+
+constexpr void Config::parseArp(const char*& curr)
+{
+    using namespace config_parse;
+
+    if (matchModifier(curr, "up"))
+        arpMode = ArpMode::Up;
+    else if (matchModifier(curr, "down"))
+        arpMode = ArpMode::Down;
+    else if (matchModifier(curr, "random"))
+        arpMode = ArpMode::Random;
+    else if (matchModifier(curr, "joy"))
+        arpMode = ArpMode::Joystick;
+    else if (matchModifier(curr, "off"))
+        arpMode = ArpMode::Off;
+    else
+    {
+        skipWs(curr);
+        errorAt("expected up, down, random, joy or off", curr);
+        return;
+    }
+
+    for (;;)
+    {
+        if (matchModifier(curr, "span"))
+            arpSpan = std::clamp<byte>(parseByte(curr, &curr), 1, 32);
+        else if (matchModifier(curr, "gate"))
+            arpGatePct = std::clamp<byte>(parseByte(curr, &curr), 1, 100);
+        else
+            break;
+    }
+}
+
+constexpr void Config::refreshScaleNotes()
+{
+    numValidNotes = 0;
+    for (uint octave=firstOctave; octave<=lastOctave && octave<MaxOctaves; ++octave)
+    {
+        uint offset = uint(key) + (octave * 12);
+        for (uint i=0; i<numScaleNotes; ++i)
+        {
+            const uint note = offset + scaleNotes[i];
+            if (note > 127)
+                return;
+
+            validNotes[numValidNotes] = byte(note);
+            ++numValidNotes;
+        }
+    }
+}
+
+// the floating point's done here, once, so nothing that runs per frame has to
+constexpr void Config::refreshTiming()
+{
+    const double beatUs = 60.0 * 1000 * 1000 / std::max<byte>(bpm, 1);
+    autoRepeatMs = uint32_t(beatUs * division / 1000);
+    autoRepeatTicks = uint16_t(std::clamp(int(division * 24 + 0.5f), 1, 0xffff));
+    stepUsQ8 = uint64_t(beatUs * 256 * division);
+}
+
+constexpr void Config::Runtime::set(uint ix, const Mapping& mapping)
+{
+    destType[ix] = mapping.destType;
+    destParam[ix] = mapping.destParam;
+    toLo[ix] = mapping.toLo;
+    toHi[ix] = mapping.toHi;
+    emaAlpha[ix] = mapping.emaAlpha;
+    hysteresis[ix] = mapping.hysteresis;
+    minIntervalUs[ix] = mapping.getMinIntervalUs();
+}
+
+// back to blank, field by field so nothing big gets built on the stack
+constexpr void Config::reset()
+{
+    channel = 1;
+    key = Key::C;
+    std::fill(std::begin(scaleNotes), std::end(scaleNotes), 0);
+    numScaleNotes = 0;
+    bpm = 100;
+    firstOctave = 2;
+    lastOctave = 7;
+    division = 0.5f;
+    sampleRateHz = 0;
+    outputPorts = MidiPort_All;
+    thru = false;
+    sync = Sync::Internal;
+    clockOut = false;
+    arpMode = ArpMode::Off;
+    arpSpan = 4;
+    arpGatePct = 50;
+
+    for (Mapping& mapping : mappings)
+        mapping = Mapping{};
+    numMappings = 0;
+
+    // cleared rather than just forgotten, so a parsed config only depends on the text it came from
+    std::fill(std::begin(validNotes), std::end(validNotes), 0);
+    numValidNotes = 0;
+    refreshTiming();
+    notesMappingIx = -1;
+    runtime = {};
+}
+
+
+constexpr void Config::beginParse()
+{
+    reset();
+}
+
+// commands can't span pieces, but otherwise it doesn't matter how the text's split up
+constexpr bool Config::parseMore(const char* text)
+{
+    using namespace config_parse;
+
+    if (!std::is_constant_evaluated())
+        clearError();
+
+    const char* curr = text;
+
+    uint commandNum = 1;
+    for (;;)
+    {
+        skipWs(curr);
+        if (!*curr)
+            break;
+
+        // if this is a comment, ignore everything to the end of the line
+        if (*curr == '#')
+        {
+            do {
+                ++curr;
+            } while(*curr && (*curr != '\n') && (*curr != '\r'));
+            continue;
+        }
+
+        auto cmdStart = curr;
+        skipToWs(curr);
+
+        switch(*cmdStart)
+        {
+            case 'C':   // CHANNEL / CLOCK
+                if (cmdStart[1] == 'L')
+                {
+                    if (matchModifier(curr, "on"))
+                        clockOut = true;
+                    else if (matchModifier(curr, "off"))
+                        clockOut = false;
+                    else
+                    {
+                        skipWs(curr);
+                        errorAt("expected on or off", curr);
+                    }
+                }
+                else
+                {
+                    channel = std::clamp<byte>(parseByte(curr, &curr), 0, 15);
+                }
+                break;
+
+            case 'R':   // ROOT / RATE
+                if (cmdStart[1] == 'A')
+                {
+                    sampleRateHz = parseUShort(curr, &curr);
+                }
+                else
+                {
+                    key = parseKey(curr);
+                    refreshScaleNotes();
+                }
+                break;
+
+            case 'S':   // SCALE / SYNC
+                if (cmdStart[1] == 'Y')
+                {
+                    if (matchModifier(curr, "int"))
+                        sync = Sync::Internal;
+                    else if (matchModifier(curr, "ext"))
+                        sync = Sync::External;
+                    else
+                    {
+                        skipWs(curr);
+                        errorAt("expected int or ext", curr);
+                    }
+                }
+                else
+                {
+                    parseScale(curr);
+                    refreshScaleNotes();
+                }
+                break;
+
+            case 'O':   // OCTAVES
+                firstOctave = parseByte(curr, &curr);
+                lastOctave = parseByte(curr, &curr);
+                refreshScaleNotes();
+                break;
+
+            case 'B':   // BPM
+                bpm = parseByte(curr, &curr);
+                break;
+
+            case 'D':   // DIVISION
+            {
+                const char* divStart = curr;
+                division = parseFloat(curr);
+                if (!(division >= MinDivision))
+                {
+                    skipWs(divStart);
+                    errorAt("division must be at least 1/24", divStart);
+                    division = MinDivision;
+                }
+                break;
+            }
+
+            case 'P':   // PORTS
+                parsePorts(curr);
+                break;
+
+            case 'T':   // THRU
+                if (matchModifier(curr, "on"))
+                    thru = true;
+                else if (matchModifier(curr, "off"))
+                    thru = false;
+                else
+                {
+                    skipWs(curr);
+                    errorAt("expected on or off", curr);
+                }
+                break;
+
+            case 'A':   // ARP
+                parseArp(curr);
+                break;
+
+            case 'M':   // MAP
+                if (numMappings < MaxMappings)
+                {
+                    parseMapping(mappings[numMappings], curr, numValidNotes);
+                    if (mappings[numMappings].destType == Dest::Note)
+                        notesMappingIx = int8_t(numMappings);
+
+                    ++numMappings;
+                }
+                else
+                {
+                    error("too many mappings");
+                }
+                break;
+
+            case 'E':   // END
+                break;
+
+            default:
+                if (!std::is_constant_evaluated())
+                    printf("%u: unknown command '%s' at char %u\n", commandNum, cmdStart, uint(cmdStart - text));
+                error("unknown command");
+                return false;
+        }
+
+        ++commandNum;
+    }
+
+    // at compile time, anything wrong has already stopped the build
+    return std::is_constant_evaluated() || !hasErrorHappened();
+}
+
+// works out everything that depends on more than one command
+constexpr void Config::endParse()
+{
+    refreshTiming();
+    for (uint i=0; i<numMappings; ++i)
+        runtime.set(i, mappings[i]);
+}
+
+constexpr bool Config::parse(const char* config)
+{
+    beginParse();
+    const bool ok = parseMore(config);
+    endParse();
+
+    if (std::is_constant_evaluated())
+        return true;
+
+    puts(ok ? "read config successfully" : "aborted config read; invalid config");
+    return ok;
+}
+
+constexpr Config Config::fromText(const char* config)
+{
+    Config parsed;
+    parsed.parse(config);
+    return parsed;
+}
@@ -0,0 +1,145 @@
+#include "ext_clock.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace {
+
+// the loop's gains, as shifts: each tick pulls the phase 1/8 of the way to it and the period
+// 1/64; enough to follow a tempo change within a beat or two, while a tick's jitter only moves
+// the next prediction by an eighth of it
+constexpr uint PhaseGainShift = 3;
+constexpr uint PeriodGainShift = 6;
+
+}
+
+
+void ExtClock::onTick(uint32_t tickUs)
+{
+    if (m_running)
+        ++m_ticks;
+
+    if (!m_haveTick || tickUs - m_lastTickUs > MaxTickUs)
+    {
+        // the first tick only gives the phase; it takes a second one for the period
+        m_haveTick = true;
+        m_locked = false;
+        m_ticksInLock = 0;
+        m_periodQ8 = 0;
+        m_estUs = tickUs;
+        m_estFracQ8 = 0;
+        m_lastTickUs = tickUs;
+        return;
+    }
+
+    if (!m_periodQ8)
+    {
+        relock(tickUs);
+        return;
+    }
+
+    // where the loop thought this tick would be
+    const uint32_t predictedQ8 = m_estFracQ8 + m_periodQ8;
+    m_estUs += predictedQ8 >> 8;
+    m_estFracQ8 = predictedQ8 & 0xff;
+    const int32_t errQ8 = int32_t(tickUs - m_estUs) * 256 - int32_t(m_estFracQ8);
+
+    // way off means a stall, a missed tick or a jump in tempo; start over from here rather than
+    // dragging the estimate across
+    if (uint32_t(std::abs(errQ8)) > m_periodQ8 / 2)
+    {
+        ++m_relocks;
+        relock(tickUs);
+        return;
+    }
+
+    const int32_t phaseQ8 = int32_t(m_estFracQ8) + (errQ8 >> PhaseGainShift);
+    m_estUs += phaseQ8 >> 8;
+    m_estFracQ8 = uint32_t(phaseQ8) & 0xff;
+    m_periodQ8 = uint32_t(int32_t(m_periodQ8) + (errQ8 >> PeriodGainShift));
+    m_lastTickUs = tickUs;
+
+    if (m_locked)
+    {
+        const uint32_t errUs = uint32_t(std::abs(errQ8)) >> 8;
+        ++m_errCount;
+        m_totalErrUs += errUs;
+        m_maxErrUs = std::max(m_maxErrUs, errUs);
+    }
+    else if (++m_ticksInLock >= LockTicks)
+    {
+        m_locked = true;
+    }
+}
+
+void ExtClock::relock(uint32_t tickUs)
+{
+    m_locked = false;
+    m_ticksInLock = 0;
+    m_periodQ8 = (tickUs - m_lastTickUs) << 8;
+    m_estUs = tickUs;
+    m_estFracQ8 = 0;
+    m_lastTickUs = tickUs;
+}
+
+void ExtClock::onStart()
+{
+    m_running = true;
+    m_ticks = 0;
+}
+
+void ExtClock::onContinue()
+{
+    m_running = true;
+}
+
+void ExtClock::onStop()
+{
+    m_running = false;
+}
+
+void ExtClock::update(uint32_t nowUs)
+{
+    if (m_haveTick && nowUs - m_lastTickUs > MaxTickUs)
+    {
+        m_haveTick = false;
+        m_locked = false;
+    }
+}
+
+uint32_t ExtClock::getTickTimeUs(uint32_t tick) const
+{
+    // the last tick to come in was m_ticks - 1
+    const int32_t ahead = int32_t(tick - m_ticks) + 1;
+    return m_estUs + uint32_t((int64_t(ahead) * m_periodQ8 + m_estFracQ8) >> 8);
+}
+
+void ExtClock::dumpStats() const
+{
+    if (!m_haveTick)
+    {
+        puts("no clock");
+        return;
+    }
+
+    const uint32_t tickUs = getTickUs();
+    const uint32_t centiBpm = tickUs ? uint32_t(60ull * 1000 * 1000 * 100 / (uint64_t(tickUs) * TicksPerBeat)) : 0;
+    printf("clock %s, %s; %u ticks since start, %u us per tick (%u.%02u bpm)\n",
+        m_running ? "running" : "stopped", m_locked ? "locked" : "locking", uint(m_ticks), uint(tickUs),
+        uint(centiBpm / 100), uint(centiBpm % 100));
+    if (m_errCount)
+    {
+        printf("ticks off prediction by mean %u max %u us; %u relocks\n",
+            uint(m_totalErrUs / m_errCount), uint(m_maxErrUs), uint(m_relocks));
+    }
+}
+
+void ExtClock::resetStats()
+{
+    m_errCount = 0;
+    m_totalErrUs = 0;
+    m_maxErrUs = 0;
+    m_relocks = 0;
+}
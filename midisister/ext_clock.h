@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include "util.h"
+
+
+// follows an incoming midi clock, 24 ticks to the quarter note
+// tick times are taken as the uart's rx is emptied, so each carries up to a loop pass (or the rx
+// irq's timeout) of jitter. a phase locked loop smooths them into a steady tick period and a
+// prediction of when each coming tick is due, so things can be scheduled on them ahead of time
+class ExtClock
+{
+public:
+    static constexpr uint TicksPerBeat = 24;
+    // ticks further apart than this (10bpm) mean the clock's gone
+    static constexpr uint32_t MaxTickUs = 250 * 1000;
+    // it takes this many ticks in a row that fit before the predictions are trusted
+    static constexpr uint LockTicks = 12;
+
+    void onTick(uint32_t tickUs);
+    void onStart();
+    void onContinue();
+    void onStop();
+    // lets go of the clock once ticks stop coming
+    void update(uint32_t nowUs);
+
+    bool isLocked() const       { return m_locked; }
+    bool isRunning() const      { return m_running; }
+    // ticks since the last start; the next one to come is this one
+    uint32_t getTicks() const   { return m_ticks; }
+    uint32_t getTickUs() const  { return m_periodQ8 >> 8; }
+    // when the given tick (counted from the start) is due, going by the tempo so far
+    uint32_t getTickTimeUs(uint32_t tick) const;
+
+    void dumpStats() const;
+    void resetStats();
+
+private:
+    void relock(uint32_t tickUs);
+
+    bool     m_running = false;
+    bool     m_locked = false;
+    bool     m_haveTick = false;
+    uint32_t m_ticks = 0;
+    uint     m_ticksInLock = 0;
+    uint32_t m_lastTickUs = 0;      // as it came in
+
+    // the loop's state: when it reckons the last tick was, to 1/256us, and the period between them
+    uint32_t m_estUs = 0;
+    uint32_t m_estFracQ8 = 0;
+    uint32_t m_periodQ8 = 0;
+
+    // how far each tick came in from where it was predicted
+    uint32_t m_errCount = 0;
+    uint64_t m_totalErrUs = 0;
+    uint32_t m_maxErrUs = 0;
+    uint32_t m_relocks = 0;
+};
@@ -1,123 +1,138 @@
 #include "flash_save.h"
+#include "config.h"
+#include "flash_store.h"
 #include "util.h"
 
 #include "pico/stdlib.h"
-#include "hardware/sync.h"
-#include <algorithm>
 #include <cstring>
+#include <iterator>
 
+FlashStore flashStore(Flash_SaveBufOffset, Flash_SaveBufSize);
+
+// a preset's config is the record with the same number
+static_assert(NumPresets <= FlashStore::MaxRecords);
+
+// the config record's payload
+struct SavedConfig
+{
+    uint16_t imageVersion;  // Config::ImageVersion of the firmware that saved it
+    uint16_t imageSize;     // sizeof(Config), ditto
+    uint32_t textLength;    // including the terminator
+    // followed by the Config image, then the source text it was parsed from
+    byte data[];
+
+    const byte* getImage() const    { return data; }
+    const char* getText() const     { return (const char*)(data + imageSize); }
+};
+static_assert(sizeof(SavedConfig) == 8);
 
-// workaround for flash header snafu
-extern "C" {
-#include "hardware/flash.h"
-}
 
-constexpr ptrdiff_t Flash_SaveBufSize = 100 * 1024;
-struct FlashSave
+// before the flash store, a single save of just the text lived at the start of the region; it's
+// still read until the first save over the top of it
+struct LegacySave
 {
     static constexpr uint32_t Magic = 'NUN1';
-    // NOTE because we're writing to flash and con only change 1->0, these are inverted
-    enum Flags : uint32_t
-    {
-        Flag_None = ~0u,
-        Flag_Invalid = 1 << 0,
-    };
+    // NOTE because we're writing to flash and con only change 1->0, this is inverted
+    static constexpr uint32_t Flag_Invalid = 1 << 0;
 
     uint32_t magic;
     uint32_t flags;
     uint32_t length;
     char data[];
+
+    bool isValid() const                { return magic == Magic && (flags & Flag_Invalid) == 0; }
+    const char* getText() const         { return data; }
 };
-static_assert(sizeof(FlashSave) == 12);
-constexpr uint32_t Flash_MaxDataSize = Flash_SaveBufSize - sizeof(FlashSave);
-constexpr ptrdiff_t Flash_SaveBufOffset = PICO_FLASH_SIZE_BYTES - Flash_SaveBufSize;
-FlashSave* Flash_SaveBuf = (FlashSave*)(XIP_BASE + Flash_SaveBufOffset);
+static_assert(sizeof(LegacySave) == 12);
+const LegacySave* Flash_LegacySave = (const LegacySave*)(XIP_BASE + Flash_SaveBufOffset);
+
+
+const SavedConfig* get_saved_config(uint preset)
+{
+    uint32_t length = 0;
+    const SavedConfig* saved = (const SavedConfig*)flashStore.find(uint16_t(preset), &length);
+    if (!saved || length < sizeof(SavedConfig) || length != sizeof(SavedConfig) + saved->imageSize + saved->textLength)
+        return nullptr;
 
+    return saved;
+}
 
 
-bool is_flash_save_valid()
+bool is_flash_save_valid(uint preset)
 {
-    if (Flash_SaveBuf->magic != FlashSave::Magic)
-    {
-        puts("FLASH: nomagic");
-        return false;
-    }
+    if (get_saved_config(preset))
+        return true;
 
-    if ((Flash_SaveBuf->flags & FlashSave::Flag_Invalid) != 0)
-    {
-        puts("FLASH: invalid");
-        return false;
-    }
+    if (preset == 0 && Flash_LegacySave->isValid())
+        return true;
 
-    return true;
+    printf("FLASH: nothing saved for preset %u\n", preset);
+    return false;
 }
 
-const char* get_flash_save_data()
+const char* get_flash_save_data(uint preset)
 {
-    if (!is_flash_save_valid())
-    {
-        puts("ERR: trying to read invalid flash");
-        onError();
-    }
+    if (const SavedConfig* saved = get_saved_config(preset))
+        return saved->getText();
 
-    return Flash_SaveBuf->data;
-}
+    if (preset == 0 && Flash_LegacySave->isValid())
+        return Flash_LegacySave->getText();
 
+    puts("ERR: trying to read invalid flash");
+    onError();
+    return "";
+}
 
-void save_flash_data(const uint8_t* data)
+bool load_flash_config(Config& config, uint preset)
 {
-    const uint32_t dataLength = strlen((const char*)data) + 1;
-    const uint32_t writeLength = sizeof(FlashSave) + dataLength;
-    if (writeLength + 1 >= Flash_MaxDataSize)
+    if (!is_flash_save_valid(preset))
+        return false;
+
+    const SavedConfig* saved = get_saved_config(preset);
+    if (saved && saved->imageVersion == Config::ImageVersion && saved->imageSize == sizeof(Config))
     {
-        puts("ERR: save data too big for buffer");
-        onError();
-        return;
+        memcpy(&config, saved->getImage(), sizeof(Config));
+        return true;
     }
 
-    uint32_t firstPageDataLen = std::min<uint32_t>(dataLength, FLASH_PAGE_SIZE - sizeof(FlashSave));
+    puts("FLASH: saved config is from another firmware version; reparsing");
+    return config.parse(get_flash_save_data(preset));
+}
 
-    // we need to set up our first page with the header on it
-    uint32_t firstPageBuf[FLASH_PAGE_SIZE / sizeof(uint32_t)];
-    FlashSave* bufToWrite = reinterpret_cast<FlashSave*>(firstPageBuf);
-    bufToWrite->magic = FlashSave::Magic;
-    bufToWrite->length = dataLength;
-    memcpy(bufToWrite->data, data, firstPageDataLen);
 
-    if (writeLength <= FLASH_PAGE_SIZE)
-    {
-        bufToWrite->flags &= ~FlashSave::Flag_Invalid;
-        
-        static_assert(FLASH_SECTOR_SIZE >= FLASH_PAGE_SIZE);
-        printf("writing single flash page; %u bytes\n", writeLength);
-
-        uint32_t savedIntrMask = save_and_disable_interrupts();
-        flash_range_erase(Flash_SaveBufOffset, 1 * FLASH_SECTOR_SIZE);
-        flash_range_program(Flash_SaveBufOffset, (uint8_t*)firstPageBuf, FLASH_PAGE_SIZE);
-        restore_interrupts(savedIntrMask);
-        return;
-    }
+bool save_flash_config(const Config& config, const char* text, uint preset)
+{
+    SavedConfig header;
+    header.imageVersion = Config::ImageVersion;
+    header.imageSize = sizeof(Config);
+    header.textLength = strlen(text) + 1;
+
+    const FlashStore::Chunk chunks[] = {
+        { &header, sizeof(SavedConfig) },
+        { &config, sizeof(Config) },
+        { text, header.textLength },
+    };
 
-    bufToWrite->flags = FlashSave::Flag_None;       // note: we first write it invalid, then rewrite this page at the end set to valid
-
-    const uint32_t extraWriteLen = dataLength - firstPageDataLen;
-    const uint32_t numPages = div_round_up<uint32_t>(writeLength, FLASH_PAGE_SIZE);
-    const uint32_t numExtraPages = numPages - 1;
-    const uint32_t numSectors = div_round_up<uint32_t>(numPages * FLASH_PAGE_SIZE, FLASH_SECTOR_SIZE);
-
-    printf("writing flash; %u bytes, %u pages, %u sector%s\n", writeLength, numPages, numSectors, (numSectors != 1) ? "s" : "");
-
-    uint32_t savedIntrMask = save_and_disable_interrupts();
-    flash_range_erase(Flash_SaveBufOffset, numSectors * FLASH_SECTOR_SIZE);
-    // write page 1 invalid
-    flash_range_program(Flash_SaveBufOffset, (uint8_t*)firstPageBuf, FLASH_PAGE_SIZE);
-    // write remainder
-    const uint8_t* sourcePtr = data + firstPageDataLen;
-    flash_range_program(Flash_SaveBufOffset + FLASH_PAGE_SIZE, sourcePtr, numExtraPages * FLASH_PAGE_SIZE);
-    // rewrite page 1 valid
-    bufToWrite->flags &= ~FlashSave::Flag_Invalid;
-    flash_range_program(Flash_SaveBufOffset, (uint8_t*)firstPageBuf, FLASH_PAGE_SIZE);
-    restore_interrupts(savedIntrMask);
+    printf("writing flash; %u bytes\n", uint(sizeof(SavedConfig) + sizeof(Config) + header.textLength));
+    return flashStore.write(uint16_t(preset), chunks, std::size(chunks));
 }
 
+bool update_flash_save()
+{
+    return flashStore.update();
+}
 
+void set_flash_live_irqs(uint32_t irqMask)
+{
+    flashStore.setLiveIrqs(irqMask);
+}
+
+void set_flash_core1_running(bool running)
+{
+    flashStore.setOtherCoreRunning(running);
+}
+
+void dump_flash_store()
+{
+    flashStore.dumpStats();
+}
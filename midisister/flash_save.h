@@ -1,8 +1,34 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include "util.h"
 
+class Config;
 
-bool is_flash_save_valid();
-const char* get_flash_save_data();
-void save_flash_data(const uint8_t* data);
\ No newline at end of file
+// each preset gets its own saved config; preset 0 is the one older firmware saved
+constexpr uint NumPresets = 8;
+
+// the flash store's region, at the top of flash
+constexpr ptrdiff_t Flash_SaveBufSize = 100 * 1024;
+constexpr ptrdiff_t Flash_SaveBufOffset = PICO_FLASH_SIZE_BYTES - Flash_SaveBufSize;
+
+
+bool is_flash_save_valid(uint preset = 0);
+// the source text of the saved config
+const char* get_flash_save_data(uint preset = 0);
+// copies the saved config image out, or re-parses the saved text if the image came from a
+// firmware with a different Config layout; false if there's nothing valid saved
+bool load_flash_config(Config& config, uint preset = 0);
+// appends to the flash store, so it's normally just page programs; see flash_store.h
+// everything's copied into ram and written out a step at a time by update_flash_save()
+// false if it can't be; eg. another preset's save is still waiting behind the one in progress
+bool save_flash_config(const Config& config, const char* text, uint preset = 0);
+// does the next step of a save in progress; false if there was nothing to do
+bool update_flash_save();
+// irqs to leave running while flash is busy; see FlashStore::setLiveIrqs
+void set_flash_live_irqs(uint32_t irqMask);
+// once core1 is up & can be locked out; see FlashStore::setOtherCoreRunning
+void set_flash_core1_running(bool running);
+
+void dump_flash_store();
@@ -0,0 +1,459 @@
+#include "flash_store.h"
+
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#if MIDISISTER_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+
+// workaround for flash header snafu
+extern "C" {
+#include "hardware/flash.h"
+}
+
+namespace {
+
+// nothing may run from flash while it's being written; see the notes on FlashStore
+struct FlashWriteLock
+{
+    uint32_t maskedIrqs = 0;
+    bool     lockedOtherCore = false;
+
+    FlashWriteLock(uint32_t liveIrqs, bool otherCoreRunning)
+    {
+#if MIDISISTER_DUAL_CORE
+        // there's no one to answer a lockout until the other core's up, so it'd wait forever
+        lockedOtherCore = otherCoreRunning;
+        if (lockedOtherCore)
+            multicore_lockout_start_blocking();
+#else
+        (void)otherCoreRunning;
+#endif
+        for (uint irq=0; irq<NUM_IRQS; ++irq)
+        {
+            if (!(liveIrqs & (1u << irq)) && irq_is_enabled(irq))
+                maskedIrqs |= 1u << irq;
+        }
+        irq_set_mask_enabled(maskedIrqs, false);
+    }
+    ~FlashWriteLock()
+    {
+        irq_set_mask_enabled(maskedIrqs, true);
+#if MIDISISTER_DUAL_CORE
+        if (lockedOtherCore)
+            multicore_lockout_end_blocking();
+#endif
+    }
+};
+
+const byte* flash_ptr(uint32_t offset)
+{
+    return (const byte*)(XIP_BASE + offset);
+}
+
+uint32_t pages_for(uint32_t length)
+{
+    return div_round_up<uint32_t>(length, FLASH_PAGE_SIZE);
+}
+
+}
+
+
+uint32_t FlashStore::RecordHeader::calcCrc(const Chunk* chunks, uint numChunks) const
+{
+    uint32_t crc = crc32(&seq, sizeof(seq));
+    crc = crc32(&key, sizeof(key), crc);
+    crc = crc32(&length, sizeof(length), crc);
+    for (uint i=0; i<numChunks; ++i)
+        crc = crc32(chunks[i].data, chunks[i].length, crc);
+    return crc;
+}
+
+
+FlashStore::FlashStore(uint32_t regionOffset, uint32_t regionSize)
+    : m_regionOffset(regionOffset)
+    , m_bankSize((regionSize / 2) & ~(FLASH_SECTOR_SIZE - 1))
+{
+    static_assert(sizeof(RecordHeader) == 20);
+    static_assert(NUM_IRQS <= 32, "live irqs are a 32 bit mask");
+}
+
+const FlashStore::RecordHeader* FlashStore::getHeader(uint32_t offset) const
+{
+    return (const RecordHeader*)flash_ptr(offset);
+}
+
+bool FlashStore::isValidRecord(uint32_t offset, uint32_t bankEnd) const
+{
+    if (offset + sizeof(RecordHeader) > bankEnd)
+        return false;
+
+    const RecordHeader* header = getHeader(offset);
+    if (header->magic != RecordHeader::Magic || header->length > bankEnd - offset - sizeof(RecordHeader))
+        return false;
+
+    const Chunk payload = { header->getPayload(), header->length };
+    return header->calcCrc(&payload, 1) == header->crc;
+}
+
+bool FlashStore::isErased(uint32_t offset, uint32_t length) const
+{
+    const uint32_t* words = (const uint32_t*)flash_ptr(offset);
+    for (uint32_t i=0; i<length/sizeof(uint32_t); ++i)
+    {
+        if (words[i] != ~0u)
+            return false;
+    }
+    return true;
+}
+
+FlashStore::Entry* FlashStore::findEntry(uint16_t key)
+{
+    for (uint i=0; i<m_numEntries; ++i)
+    {
+        if (m_entries[i].key == key)
+            return &m_entries[i];
+    }
+    return nullptr;
+}
+
+
+void FlashStore::mount()
+{
+    m_mounted = true;
+    m_numEntries = 0;
+    m_activeBank = 0;
+    m_head = getBankStart(0);
+    m_nextSeq = 1;
+
+    uint32_t newestSeq = 0;
+    for (uint bank=0; bank<2; ++bank)
+    {
+        const uint32_t bankEnd = getBankEnd(bank);
+        for (uint32_t offset = getBankStart(bank); offset < bankEnd; )
+        {
+            if (!isValidRecord(offset, bankEnd))
+            {
+                offset += FLASH_PAGE_SIZE;
+                continue;
+            }
+
+            const RecordHeader* header = getHeader(offset);
+            const uint32_t recordEnd = offset + pages_for(header->getTotalLength()) * FLASH_PAGE_SIZE;
+
+            Entry* entry = findEntry(header->key);
+            if (!entry && m_numEntries < MaxRecords)
+            {
+                entry = &m_entries[m_numEntries++];
+                entry->key = header->key;
+                entry->seq = 0;
+            }
+            if (entry && header->seq > entry->seq)
+            {
+                entry->offset = offset;
+                entry->seq = header->seq;
+            }
+
+            if (header->seq > newestSeq)
+            {
+                newestSeq = header->seq;
+                m_activeBank = bank;
+                m_head = recordEnd;
+            }
+
+            offset = recordEnd;
+        }
+    }
+    m_nextSeq = newestSeq + 1;
+
+    // anything newest in the other bank means we lost power part way through a collect; finish
+    // the job, otherwise the next one would erase the only copy
+    beginNext();
+    flush();
+}
+
+const byte* FlashStore::find(uint16_t key, uint32_t* outLength)
+{
+    if (!m_mounted)
+        mount();
+
+    const Entry* entry = findEntry(key);
+    if (!entry)
+        return nullptr;
+
+    const RecordHeader* header = getHeader(entry->offset);
+    if (outLength)
+        *outLength = header->length;
+    return header->getPayload();
+}
+
+bool FlashStore::write(uint16_t key, const Chunk* chunks, uint numChunks)
+{
+    if (!m_mounted)
+        mount();
+
+    // a staged write that hasn't started yet is simply superseded by a newer one of the same record;
+    // there's only room for the one though
+    const bool superseding = m_staged && m_stagedKey == key;
+    if (m_staged && !superseding)
+    {
+        printf("FLASH: record %u is still waiting to be written; try again once it's started\n", uint(m_stagedKey));
+        return false;
+    }
+
+    if (!findEntry(key) && m_numEntries >= MaxRecords)
+    {
+        puts("ERR: flash store has no room for another record");
+        onError();
+        return false;
+    }
+
+    uint32_t length = 0;
+    for (uint i=0; i<numChunks; ++i)
+    {
+        if (chunks[i].length > MaxPayloadSize - length)
+        {
+            puts("ERR: too big for the flash store");
+            onError();
+            return false;
+        }
+        memcpy(m_staging[m_stagingBuf] + length, chunks[i].data, chunks[i].length);
+        length += chunks[i].length;
+    }
+
+    m_staged = true;
+    m_stagedKey = key;
+    m_stagedLength = length;
+    m_stagedAtUs = time_us_32();
+    if (!superseding)
+        m_collected = false;
+    // otherwise it's picked up once what's in progress is done
+    if (!isBusy())
+        beginNext();
+    return isBusy();
+}
+
+bool FlashStore::update()
+{
+    if (m_step == Step::Idle)
+        return false;
+
+    const uint32_t stepStartUs = time_us_32();
+    if (m_step == Step::Erase)
+    {
+        // sectors that are already erased don't need a step of their own
+        const uint32_t bankEnd = getBankEnd(1 - m_activeBank);
+        while (m_eraseOffset < bankEnd && isErased(m_eraseOffset, FLASH_SECTOR_SIZE))
+            m_eraseOffset += FLASH_SECTOR_SIZE;
+
+        if (m_eraseOffset < bankEnd)
+        {
+            FlashWriteLock lock(m_liveIrqs, m_otherCoreRunning);
+            flash_range_erase(m_eraseOffset, FLASH_SECTOR_SIZE);
+            m_eraseOffset += FLASH_SECTOR_SIZE;
+            ++m_sectorsErased;
+        }
+
+        if (m_eraseOffset >= bankEnd)
+        {
+            // the old bank is left alone; its records stay the newest copies until they're carried over
+            m_activeBank = 1 - m_activeBank;
+            m_head = getBankStart(m_activeBank);
+            m_step = Step::Idle;
+            beginNext();
+        }
+    }
+    else
+    {
+        programPage(m_record.nextPage++);
+        if (m_record.nextPage > m_record.numPages)
+        {
+            finishRecord();
+            m_step = Step::Idle;
+            beginNext();
+        }
+    }
+
+    m_maxStepUs = std::max(m_maxStepUs, time_us_32() - stepStartUs);
+    return true;
+}
+
+void FlashStore::flush()
+{
+    while (update())
+        ;
+}
+
+void FlashStore::beginNext()
+{
+    // anything still newest in the other bank goes first, so that it's never the only copy when
+    // that bank is next erased
+    for (uint i=0; i<m_numEntries; ++i)
+    {
+        const Entry& entry = m_entries[i];
+        if (getBankFor(entry.offset) == m_activeBank)
+            continue;
+
+        const RecordHeader* header = getHeader(entry.offset);
+        printf("FLASH: carrying record %u over to bank %u\n", uint(entry.key), m_activeBank);
+        // no room left, eg. a torn carry over took it; a collect is the only way to get more, and
+        // that would erase the very copy we're carrying, so it's up to beginCollect to say no
+        if (!beginRecord(entry.key, { header->getPayload(), header->length }) && !beginCollect())
+        {
+            puts("ERR: flash store couldn't carry a record over");
+            onError();
+            abort();
+        }
+        return;
+    }
+
+    if (!m_staged)
+        return;
+
+    if (beginRecord(m_stagedKey, { m_staging[m_stagingBuf], m_stagedLength }))
+    {
+        m_record.isWrite = true;
+        m_record.stagedAtUs = m_stagedAtUs;
+        m_staged = false;
+        m_stagingBuf = 1 - m_stagingBuf;
+        return;
+    }
+
+    // out of room (or something's scribbled past the head); start afresh in the other bank
+    if (!m_collected && beginCollect())
+        return;
+
+    puts("ERR: flash store is full");
+    onError();
+    abort();
+}
+
+void FlashStore::abort()
+{
+    m_step = Step::Idle;
+    m_staged = false;
+}
+
+bool FlashStore::beginRecord(uint16_t key, const Chunk& payload)
+{
+    RecordHeader& header = m_record.header;
+    header.magic = RecordHeader::Magic;
+    header.seq = m_nextSeq;
+    header.key = key;
+    header.reserved = 0xffff;
+    header.length = payload.length;
+    header.crc = header.calcCrc(&payload, 1);
+
+    const uint32_t numPages = pages_for(header.getTotalLength());
+    const uint32_t length = numPages * FLASH_PAGE_SIZE;
+
+    // step over anything left behind by a write that was cut off part way
+    const uint32_t bankEnd = getBankEnd(m_activeBank);
+    while (m_head + length <= bankEnd && !isErased(m_head, length))
+        m_head += FLASH_PAGE_SIZE;
+    if (m_head + length > bankEnd)
+        return false;
+
+    m_record.payload = payload;
+    m_record.offset = m_head;
+    m_record.nextPage = 1;
+    m_record.numPages = numPages;
+    m_record.isWrite = false;
+    m_step = Step::Program;
+    return true;
+}
+
+void FlashStore::programPage(uint32_t page)
+{
+    // the header page goes last, so until the very end there isn't even a record here
+    const uint32_t pageIx = page % m_record.numPages;
+
+    // the header & payload are one stream as far as flash is concerned; this pulls a page out of it
+    // NB. the payload can be in flash itself, so it has to be copied out before the lock
+    uint32_t pageBuf[FLASH_PAGE_SIZE / sizeof(uint32_t)];
+    byte* dst = (byte*)pageBuf;
+    memset(dst, 0xff, FLASH_PAGE_SIZE);
+
+    const uint32_t pageStart = pageIx * FLASH_PAGE_SIZE;
+    const uint32_t pageEnd = pageStart + FLASH_PAGE_SIZE;
+    auto copyPart = [&](const void* src, uint32_t partStart, uint32_t partLength)
+    {
+        const uint32_t from = std::max(partStart, pageStart);
+        const uint32_t to = std::min(partStart + partLength, pageEnd);
+        if (from < to)
+            memcpy(dst + (from - pageStart), (const byte*)src + (from - partStart), to - from);
+    };
+    copyPart(&m_record.header, 0, sizeof(RecordHeader));
+    copyPart(m_record.payload.data, sizeof(RecordHeader), m_record.payload.length);
+
+    FlashWriteLock lock(m_liveIrqs, m_otherCoreRunning);
+    flash_range_program(m_record.offset + pageStart, (const uint8_t*)pageBuf, FLASH_PAGE_SIZE);
+}
+
+void FlashStore::finishRecord()
+{
+    const RecordHeader& header = m_record.header;
+    Entry* entry = findEntry(header.key);
+    if (!entry)
+    {
+        entry = &m_entries[m_numEntries++];
+        entry->key = header.key;
+    }
+    entry->offset = m_record.offset;
+    entry->seq = header.seq;
+
+    m_head = m_record.offset + m_record.numPages * FLASH_PAGE_SIZE;
+    ++m_nextSeq;
+    ++m_recordsWritten;
+
+    if (m_record.isWrite)
+    {
+        const uint32_t writeUs = time_us_32() - m_record.stagedAtUs;
+        m_maxWriteUs = std::max(m_maxWriteUs, writeUs);
+        printf("FLASH: record %u written in %u ms\n", uint(header.key), uint(writeUs / 1000));
+    }
+}
+
+bool FlashStore::beginCollect()
+{
+    const uint newBank = 1 - m_activeBank;
+
+    // only when carrying records over after a power cut ran out of room; erasing now would lose them
+    for (uint i=0; i<m_numEntries; ++i)
+    {
+        if (getBankFor(m_entries[i].offset) == newBank)
+        {
+            puts("ERR: flash store can't collect without losing records");
+            return false;
+        }
+    }
+
+    printf("FLASH: collecting into bank %u\n", newBank);
+    m_collected = true;
+    m_eraseOffset = getBankStart(newBank);
+    m_step = Step::Erase;
+    return true;
+}
+
+
+void FlashStore::dumpStats()
+{
+    if (!m_mounted)
+        mount();
+
+    const uint32_t bankStart = getBankStart(m_activeBank);
+    printf("flash store: bank %u, %u of %u bytes used, next seq %u\n",
+        m_activeBank, uint(m_head - bankStart), uint(m_bankSize), uint(m_nextSeq));
+    for (uint i=0; i<m_numEntries; ++i)
+    {
+        const Entry& entry = m_entries[i];
+        printf("  record %u: seq %u, %u bytes at +%u\n", uint(entry.key), uint(entry.seq),
+            uint(getHeader(entry.offset)->length), uint(entry.offset - m_regionOffset));
+    }
+    printf("since boot: %u records written, %u sectors erased\n", uint(m_recordsWritten), uint(m_sectorsErased));
+    printf("longest step %u us, longest write %u ms%s\n", uint(m_maxStepUs), uint(m_maxWriteUs / 1000), isBusy() ? "; writing now" : "");
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include "util.h"
+
+
+// log structured record store over a reserved region of flash
+//  * the region is split into two banks; records are only ever appended to the active one, so a
+//    save is just page programs
+//  * when the active bank fills up, the other one is erased, the newest copy of every record is
+//    copied across and that becomes the active bank; that's the only time anything's erased, and
+//    every sector gets erased equally often
+//  * each record carries a sequence number & a crc over everything, and its header page goes
+//    down last; a torn write is just a bad record and the previous copy is still there
+//  * writes happen in the background, one page program or sector erase per update(). a step
+//    still takes as long as the flash does (~0.4ms a page, ~45ms a sector erase, typical), and
+//    update() doesn't return until it's done. while it's running, xip is off so nothing can run
+//    from flash:
+//     - the other core (if it's running) is locked out, and parked in ram, for just that step
+//     - on this core every irq is masked except the live ones (see setLiveIrqs), which keep
+//       running from ram
+class FlashStore
+{
+public:
+    struct Chunk
+    {
+        const void* data;
+        uint32_t    length;
+    };
+
+    static constexpr uint MaxRecords = 16;
+    // a write is staged in ram until it's down; this fits a config upload & its image
+    static constexpr uint32_t MaxPayloadSize = 6 * 1024;
+
+    FlashStore(uint32_t regionOffset, uint32_t regionSize);
+
+    // irqs in the mask stay enabled while flash is busy; their handlers, and everything they
+    // touch, must be in ram
+    void setLiveIrqs(uint32_t irqMask)      { m_liveIrqs = irqMask; }
+    // the other core is only locked out once it's running & has called
+    // multicore_lockout_victim_init; until then (eg. a mount at boot) there's nothing to lock out
+    void setOtherCoreRunning(bool running)  { m_otherCoreRunning = running; }
+
+    // finds the newest copy of every record; the other calls do this themselves the first time
+    void mount();
+
+    // points straight into (xip) flash; nullptr if there's no such record
+    const byte* find(uint16_t key, uint32_t* outLength = nullptr);
+
+    // the record is made up of the chunks back to back; they're copied, so can go away as soon
+    // as this returns. update() then does the actual writing. one write can wait its turn behind
+    // whatever's in progress; a newer write of that same record replaces it, but one of another
+    // record is refused (false, without an error) until the waiting one has started
+    // the previous copy stays readable until this one is completely written
+    bool write(uint16_t key, const Chunk* chunks, uint numChunks);
+
+    // does the next step of a write, if there is one; false if there was nothing to do
+    bool update();
+    bool isBusy() const                     { return m_step != Step::Idle; }
+    // blocks until there's nothing left to write
+    void flush();
+
+    void dumpStats();
+
+private:
+    struct RecordHeader
+    {
+        static constexpr uint32_t Magic = 'NREC';
+
+        uint32_t magic;
+        uint32_t seq;
+        uint16_t key;
+        uint16_t reserved;  // left erased
+        uint32_t length;    // of the payload, which follows straight on
+        uint32_t crc;       // over seq, key & length, then the payload
+
+        uint32_t calcCrc(const Chunk* chunks, uint numChunks) const;
+
+        const byte* getPayload() const      { return (const byte*)(this + 1); }
+        uint32_t getTotalLength() const     { return sizeof(RecordHeader) + length; }
+    };
+
+    struct Entry
+    {
+        uint16_t key;
+        uint32_t offset;    // of the header, from the start of flash
+        uint32_t seq;
+    };
+
+    uint32_t getBankStart(uint bank) const  { return m_regionOffset + bank * m_bankSize; }
+    uint32_t getBankEnd(uint bank) const    { return getBankStart(bank) + m_bankSize; }
+    uint getBankFor(uint32_t offset) const  { return (offset - m_regionOffset) / m_bankSize; }
+
+    const RecordHeader* getHeader(uint32_t offset) const;
+    bool isValidRecord(uint32_t offset, uint32_t bankEnd) const;
+    bool isErased(uint32_t offset, uint32_t length) const;
+    Entry* findEntry(uint16_t key);
+
+    enum class Step : uint8_t
+    {
+        Idle,
+        Erase,      // the next sector of the bank being collected into
+        Program,    // the next page of m_record
+    };
+
+    // sets up m_record at the head; false if it won't fit in the active bank
+    bool beginRecord(uint16_t key, const Chunk& payload);
+    void programPage(uint32_t page);
+    void finishRecord();
+    bool beginCollect();
+    // picks what happens once a record is done: carrying over anything left in the other bank,
+    // then the staged write
+    void beginNext();
+    void abort();
+
+    uint32_t m_regionOffset;
+    uint32_t m_bankSize;
+    uint32_t m_liveIrqs = 0;
+    bool     m_otherCoreRunning = false;
+
+    bool     m_mounted = false;
+    uint     m_activeBank = 0;
+    uint32_t m_head = 0;        // where the next record goes
+    uint32_t m_nextSeq = 1;
+
+    Entry    m_entries[MaxRecords] = {};
+    uint     m_numEntries = 0;
+
+    Step     m_step = Step::Idle;
+    uint32_t m_eraseOffset = 0;
+    bool     m_collected = false;   // for the staged write; a second collect wouldn't find any more room
+    struct
+    {
+        RecordHeader header;
+        Chunk        payload;
+        uint32_t     offset;
+        uint32_t     nextPage;
+        uint32_t     numPages;
+        bool         isWrite;       // rather than a carry over
+        uint32_t     stagedAtUs;    // ditto
+    } m_record = {};
+
+    bool     m_staged = false;      // a write is waiting in m_staging[m_stagingBuf]
+    uint16_t m_stagedKey = 0;
+    uint32_t m_stagedLength = 0;
+    uint32_t m_stagedAtUs = 0;
+    // the write being programmed reads from one buffer while the next waits its turn in the other
+    byte     m_staging[2][MaxPayloadSize];
+    uint     m_stagingBuf = 0;
+
+    uint32_t m_recordsWritten = 0;
+    uint32_t m_sectorsErased = 0;
+    uint32_t m_maxStepUs = 0;       // longest flash was off limits for
+    uint32_t m_maxWriteUs = 0;      // longest from write() to its record being down
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+
+// per-mapping exponential moving average over the raw sensor value, kept at 8 fractional bits so
+// that heavy smoothing doesn't stall a step short of where the input settled
+struct MappingFilter
+{
+    int32_t filtered = 0;   // raw << 8
+    bool    primed = false;
+
+    // alpha is the weight of the new sample, /256
+    uint16_t apply(uint16_t raw, uint16_t alpha)
+    {
+        const int32_t target = int32_t(raw) << 8;
+        if (!primed || alpha >= 256)
+        {
+            filtered = target;
+            primed = true;
+        }
+        else
+        {
+            filtered += ((target - filtered) * int32_t(alpha)) >> 8;
+        }
+
+        return uint16_t((filtered + 128) >> 8);
+    }
+
+    void reset()    { primed = false; }
+};
+
+
+struct MappingTrafficStats
+{
+    uint32_t sent = 0;          // controller values handed to the scheduler
+    uint32_t suppressed = 0;    // changes held back by hysteresis
+};
@@ -0,0 +1,34 @@
+#include "mapping_luts.h"
+
+
+void MappingLuts::build(const Config& config, const Nunchuk& nchk)
+{
+    const Nunchuk::Calibration& cal = nchk.getCalibration();
+    uint16_t* next = m_pool;
+
+    auto buildTable = [&](const Mapping& mapping, bool isNotes) -> Table
+    {
+        const Nunchuk::Axis axis = mapping.getAxis();
+        const uint numEntries = Nunchuk::getRawRange(axis);
+
+        uint16_t* vals = next;
+        next += numEntries;
+
+        for (uint raw=0; raw<numEntries; ++raw)
+        {
+            uint16_t val = mapping.remap(cal.calibrate(axis, uint16_t(raw)));
+            vals[raw] = isNotes ? config.getNoteForIndex(val) : val;
+        }
+
+        return { vals, axis };
+    };
+
+    for (uint i=0; i<config.getNumMappings(); ++i)
+        m_tables[i] = buildTable(config.getMappings()[i], false);
+
+    if (const Mapping* notesMapping = config.getNotesMapping())
+        m_noteTable = buildTable(*notesMapping, true);
+
+    m_calibrationId = nchk.getCalibrationId();
+    m_built = true;
+}
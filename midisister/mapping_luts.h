@@ -0,0 +1,53 @@
+#pragma once
+
+#include "config.h"
+#include "nunchuk.h"
+#include "util.h"
+
+
+// every mapping is a pure function of one raw sensor axis (8 bit joystick or 10 bit accel), so the whole
+// calibrate -> deadzone -> remap -> note lookup chain is baked into a table whenever the config or the
+// calibration changes, and evaluating a mapping each frame is a single load
+class MappingLuts
+{
+public:
+    static constexpr uint MaxEntries = Nunchuk::getRawRange(Nunchuk::Axis::AccelX);
+    // one table per mapping, plus the notes mapping's note table
+    static constexpr uint PoolEntries = (Config::MaxMappings + 1) * MaxEntries;
+    static constexpr uint RamBudget = 24 * 1024;
+    static_assert(PoolEntries * sizeof(uint16_t) <= RamBudget, "mapping luts are over their RAM budget");
+
+    void build(const Config& config, const Nunchuk& nchk);
+    bool isStale(const Nunchuk& nchk) const     { return !m_built || nchk.getCalibrationId() != m_calibrationId; }
+    // call whenever the config changes
+    void invalidate()                           { m_built = false; }
+
+    uint16_t getVal(uint mappingIx, const Nunchuk& nchk) const
+    {
+        const Table& table = m_tables[mappingIx];
+        return table.vals[nchk.getRawAxis(table.axis)];
+    }
+
+    // for when the raw value has been filtered first
+    Nunchuk::Axis getAxis(uint mappingIx) const                 { return m_tables[mappingIx].axis; }
+    uint16_t lookup(uint mappingIx, uint16_t raw) const         { return m_tables[mappingIx].vals[raw]; }
+
+    // the notes mapping's table holds midi notes rather than scale indices
+    uint8_t getMappedNote(const Nunchuk& nchk) const
+    {
+        return uint8_t(m_noteTable.vals[nchk.getRawAxis(m_noteTable.axis)]);
+    }
+
+private:
+    struct Table
+    {
+        const uint16_t* vals;
+        Nunchuk::Axis   axis;
+    };
+
+    uint16_t    m_pool[PoolEntries];
+    Table       m_tables[Config::MaxMappings] = {};
+    Table       m_noteTable = {};
+    uint32_t    m_calibrationId = 0;
+    bool        m_built = false;
+};
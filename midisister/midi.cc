@@ -1,12 +1,548 @@
 #include "midi.h"
+#include "midi_parser.h"
+#include "ring_buffer.h"
+#include "usb_midi.h"
+#include "util.h"
 
 #include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include <algorithm>
 #include <cstdio>
 
 
 namespace {
 
+// 512B is ~160ms of wire time at 31250 baud; plenty to soak up a frame's worth of bursts
+constexpr uint32_t TxQueueSize = 512;
+
+// 256B is ~80ms of wire time; the main loop empties it every pass
+constexpr uint32_t RxQueueSize = 256;
+// a few messages' worth; ours only have to wait while an incoming sysex is going through
+constexpr uint32_t HeldQueueSize = 64;
+// a quarter note's worth of clocks; the parser takes them every loop
+constexpr uint32_t RxClockTimesSize = 32;
+
 uart_inst_t* MidiUartBlock = uart0;
+RingBuffer<uint8_t, TxQueueSize> TxQueue;
+MidiTxStats TxStats;
+RingBuffer<uint8_t, RxQueueSize> RxQueue;
+MidiRxStats RxStats;
+RingBuffer<uint32_t, RxClockTimesSize> RxClockTimes;
+uint32_t TxWireFreeUs = 0;          // estimate of when the wire goes idle
+uint32_t TxFifoDryUs = 0;           // estimate of when the uart's fifo runs out
+bool TxWaiting = false;             // the last feed left bytes in the queue
+
+uint8_t Ports = MidiPort_All;
+
+bool RunningStatusEnabled = true;
+uint32_t RunningStatusRefreshMs = MidiRunningStatusRefreshMs;
+uint8_t RunningStatus = 0;          // 0 => none; the next message must send its status
+uint32_t RunningStatusSentUs = 0;
+
+bool ThruEnabled = false;
+uint8_t ThruStatus = 0;             // the input's running status, or the system common message in progress; 0 => none
+uint8_t ThruMessage[3] = {};        // the incoming message so far, status first
+uint8_t ThruHave = 0;               // data bytes in ThruMessage
+bool ThruInSysex = false;
+uint32_t ThruSysexLastUs = 0;
+RingBuffer<uint8_t, HeldQueueSize> HeldQueue;   // ours, whole messages, waiting for a thru sysex
+MidiThruStats ThruStats;
+
+struct TimedMessage
+{
+    uint32_t atUs;
+    uint8_t  len;
+    uint8_t  message[3];
+};
+TimedMessage Timed[MidiMaxTimedMessages];      // in time order
+uint NumTimed = 0;
+alarm_id_t TimedAlarm = 0;                      // 0 => none armed
+uint32_t TimedAlarmUs = 0;
+RingBuffer<TimedMessage, MidiMaxTimedMessages> TimedSentForUsb;
+
+// leaves the estimate of when the wire goes idle (and the alarm) a little slack
+constexpr uint32_t ClockGuardUs = 50;
+bool ClockEnabled = false;
+uint ClockAlarmNum = 0;
+uint32_t ClockPeriodQ8 = (60 * 1000 * 1000 * 256ull) / (120 * MidiClockTicksPerBeat);     // between ticks, to 1/256us
+uint32_t ClockNextUs = 0;           // when the next tick's due
+uint32_t ClockNextFracQ8 = 0;
+uint8_t ClockTransport = 0;         // start, continue or stop to go after the next tick; 0 => none
+bool ClockRunning = false;
+uint32_t ClockSongTicks = 0;        // since the start of the song; it only moves while running
+uint32_t ClockLastTickUs = 0;       // when the last one went out
+uint32_t ClockLastDueUs = 0;
+RingBuffer<uint8_t, 16> ClockSentForUsb;
+MidiClockStats ClockStats;
+
+// for the stats kept from the live irqs; std::max might not be inlined, and would be in flash
+__force_inline void keep_max(uint32_t& stat, uint32_t val)
+{
+    if (val > stat)
+        stat = val;
+}
+
+// NB. must be called with interrupts disabled, or from the uart irq
+// this is in ram, and only uses inline sdk calls, so it keeps running while flash is busy
+void __not_in_flash_func(feed_tx)()
+{
+    uart_hw_t* hw = uart_get_hw(MidiUartBlock);
+    const uint32_t nowUs = time_us_32();
+    uint32_t dryUs = (int32_t(TxFifoDryUs - nowUs) > 0) ? TxFifoDryUs : nowUs;
+    uint32_t fed = 0;
+    bool held = false;
+    uint8_t next;
+    while (uart_is_writable(MidiUartBlock) && !TxQueue.empty())
+    {
+        // the wire has to be clear by the next clock tick; its alarm carries on from here
+        if (ClockEnabled && int32_t(ClockNextUs - (dryUs + MidiByteTimeUs)) < int32_t(ClockGuardUs))
+        {
+            held = true;
+            break;
+        }
+
+        TxQueue.pop(next);
+        hw->dr = next;
+        dryUs += MidiByteTimeUs;
+        ++fed;
+    }
+
+    if (fed)
+    {
+        // if the fifo ran dry while there was more waiting, the wire sat idle in between
+        if (TxWaiting && int32_t(nowUs - TxFifoDryUs) > 0)
+            keep_max(TxStats.maxGapUs, nowUs - TxFifoDryUs);
+
+        TxFifoDryUs = dryUs;
+        TxStats.bytesSent += fed;
+    }
+    // a gap that's held open for a clock tick doesn't count
+    TxWaiting = !TxQueue.empty() && !held;
+
+    // the tx irq fires when the fifo drains past its threshold, so only ask for it while there's more to send
+    // (uart_set_irq_enables isn't inline, so this pokes the register directly)
+    if (TxWaiting)
+        hw_set_bits(&hw->imsc, UART_UARTIMSC_TXIM_BITS);
+    else
+        hw_clear_bits(&hw->imsc, UART_UARTIMSC_TXIM_BITS);
+}
+
+// NB. this and queue_din_message are in ram too, as thru calls them from the irq
+bool __not_in_flash_func(queue_bytes)(const uint8_t* bytes, uint32_t len)
+{
+    bool queued = TxQueue.push(bytes, len);
+    if (queued)
+    {
+        TxStats.bytesQueued += len;
+        keep_max(TxStats.peakQueued, TxQueue.size());
+        feed_tx();
+
+        const uint32_t nowUs = time_us_32();
+        if (int32_t(TxWireFreeUs - nowUs) < 0)
+            TxWireFreeUs = nowUs;
+        TxWireFreeUs += len * MidiByteTimeUs;
+    }
+    else
+    {
+        ++TxStats.messagesDropped;
+    }
+
+    return queued;
+}
+
+// applies running status to a full message (status byte first) and queues it
+bool __not_in_flash_func(queue_din_message)(const uint8_t* message, uint32_t len)
+{
+    const uint8_t status = message[0];
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+
+    bool queued;
+    if (status >= 0xf8)
+    {
+        // realtime messages don't affect running status
+        queued = queue_bytes(message, len);
+    }
+    else if (ThruInSysex)
+    {
+        // it'd cut the sysex short, so it waits its turn
+        queued = HeldQueue.push(message, len);
+        if (queued)
+            ++ThruStats.held;
+        else
+            ++TxStats.messagesDropped;
+    }
+    else if (status >= 0xf0)
+    {
+        // system common messages cancel it
+        queued = queue_bytes(message, len);
+        RunningStatus = 0;
+    }
+    else
+    {
+        // millis() isn't safe while flash is busy
+        const uint32_t nowUs = time_us_32();
+        if (RunningStatusEnabled && status == RunningStatus && (nowUs - RunningStatusSentUs) < RunningStatusRefreshMs * 1000)
+        {
+            queued = queue_bytes(message + 1, len - 1);
+            if (queued)
+                ++TxStats.bytesSaved;
+        }
+        else
+        {
+            queued = queue_bytes(message, len);
+            if (queued)
+            {
+                RunningStatus = status;
+                RunningStatusSentUs = nowUs;
+            }
+        }
+    }
+
+    restore_interrupts(savedIntrMask);
+    return queued;
+}
+
+// usb only gets what din managed to queue, so that a retry after a drop doesn't double up on it
+// usb-midi packets always carry their status; running status is just for the uart
+bool queue_message(const uint8_t* message, uint32_t len)
+{
+    if (!(Ports & MidiPort_Din))
+        return (Ports & MidiPort_Usb) && usb_midi_queue(message, len);
+
+    const bool queued = queue_din_message(message, len);
+    if (queued && (Ports & MidiPort_Usb))
+        usb_midi_queue(message, len);
+    return queued;
+}
+
+
+// NB. the rest of thru is called with interrupts disabled, or from the uart irq, and is in ram
+// for the same reason as feed_tx
+
+// a complete incoming message, or a realtime byte
+void __not_in_flash_func(thru_message)(const uint8_t* message, uint32_t len)
+{
+    const uint32_t nowUs = time_us_32();
+    const int32_t backlogUs = int32_t(TxWireFreeUs - nowUs);
+    if (!queue_din_message(message, len))
+    {
+        ++ThruStats.dropped;
+        return;
+    }
+
+    const uint32_t addedUs = (backlogUs > 0) ? uint32_t(backlogUs) : 0;
+    ++ThruStats.messages;
+    ThruStats.totalAddedUs += addedUs;
+    keep_max(ThruStats.maxAddedUs, addedUs);
+}
+
+void __not_in_flash_func(thru_sysex_byte)(uint8_t b)
+{
+    if (queue_bytes(&b, 1))
+        ++ThruStats.sysexBytes;
+    else
+        ++ThruStats.dropped;
+    ThruSysexLastUs = time_us_32();
+}
+
+// closes the sysex on the output, even if the input didn't, then lets ours go
+void __not_in_flash_func(end_thru_sysex)()
+{
+    thru_sysex_byte(0xf7);
+    ThruInSysex = false;
+
+    uint8_t message[3];
+    while (!HeldQueue.empty())
+    {
+        const uint32_t len = 1 + midi_data_len(HeldQueue.peek());
+        for (uint32_t i=0; i<len; ++i)
+            HeldQueue.pop(message[i]);
+        queue_din_message(message, len);
+    }
+}
+
+void __not_in_flash_func(thru_byte)(uint8_t b)
+{
+    if (b >= 0xf8)
+    {
+        // with clock out on, ours is the only one
+        const bool isClock = b == 0xf8 || (b >= 0xfa && b <= 0xfc);
+        if (!(ClockEnabled && isClock))
+            thru_message(&b, 1);
+        return;
+    }
+
+    if (ThruInSysex)
+    {
+        if (b < 0x80)
+        {
+            thru_sysex_byte(b);
+            return;
+        }
+
+        end_thru_sysex();
+        if (b == 0xf7)
+            return;
+    }
+
+    if (b < 0x80)
+    {
+        // a data byte with no status to go with it is dropped, as a receiver would
+        if (!ThruStatus)
+            return;
+
+        const uint32_t needed = midi_data_len(ThruStatus);
+        ThruMessage[1 + ThruHave++] = b;
+        if (ThruHave < needed)
+            return;
+
+        ThruMessage[0] = ThruStatus;
+        ThruHave = 0;
+        if (ThruStatus >= 0xf0)
+            ThruStatus = 0;
+        thru_message(ThruMessage, 1 + needed);
+        return;
+    }
+
+    ThruHave = 0;
+    ThruStatus = 0;
+    if (b == 0xf0)
+    {
+        // queue_din_message sees it as system common, which cancels the output's running status
+        if (queue_din_message(&b, 1))
+        {
+            ++ThruStats.sysexBytes;
+            ThruInSysex = true;
+            ThruSysexLastUs = time_us_32();
+        }
+        else
+        {
+            ++ThruStats.dropped;
+        }
+    }
+    else if (b < 0xf0 || midi_data_len(b) > 0)
+    {
+        ThruStatus = b;
+    }
+    else if (b == 0xf6)
+    {
+        thru_message(&b, 1);
+    }
+}
+
+void __not_in_flash_func(drain_rx)()
+{
+    uart_hw_t* hw = uart_get_hw(MidiUartBlock);
+    while (uart_is_readable(MidiUartBlock))
+    {
+        // the error flags come along with each byte; an overrun means bytes were lost before this
+        // one, but a framing error or break means this one's garbage
+        const uint32_t dr = hw->dr;
+        if (dr & (UART_UARTDR_OE_BITS | UART_UARTDR_BE_BITS | UART_UARTDR_FE_BITS))
+        {
+            ++RxStats.lineErrors;
+            if (dr & (UART_UARTDR_BE_BITS | UART_UARTDR_FE_BITS))
+                continue;
+        }
+
+        if (ThruEnabled)
+            thru_byte(uint8_t(dr));
+
+        // a clock and its timestamp go or are dropped together, or every clock after would be
+        // paired with the wrong time
+        const bool isClock = (uint8_t(dr) == 0xf8);
+        if ((isClock && RxClockTimes.full()) || !RxQueue.push(uint8_t(dr)))
+        {
+            ++RxStats.bytesDropped;
+            continue;
+        }
+        ++RxStats.bytesReceived;
+        if (isClock)
+            RxClockTimes.push(time_us_32());
+    }
+    keep_max(RxStats.peakQueued, RxQueue.size());
+}
+
+// NB. the timed messages are only touched with interrupts disabled
+void send_due_timed()
+{
+    const uint32_t nowUs = time_us_32();
+    uint sent = 0;
+    for (; sent<NumTimed && int32_t(Timed[sent].atUs - nowUs) <= 0; ++sent)
+    {
+        const TimedMessage& timed = Timed[sent];
+        if (Ports & MidiPort_Din)
+            queue_din_message(timed.message, timed.len);
+        if (Ports & MidiPort_Usb)
+            TimedSentForUsb.push(timed);
+    }
+
+    NumTimed -= sent;
+    std::copy(Timed + sent, Timed + sent + NumTimed, Timed);
+}
+
+int64_t on_timed_alarm(alarm_id_t, void*);
+
+// keeps the alarm on the earliest message
+void arm_timed()
+{
+    for (;;)
+    {
+        send_due_timed();
+        if (!NumTimed)
+        {
+            if (TimedAlarm)
+                cancel_alarm(TimedAlarm);
+            TimedAlarm = 0;
+            return;
+        }
+
+        if (TimedAlarm && TimedAlarmUs == Timed[0].atUs)
+            return;
+
+        if (TimedAlarm)
+            cancel_alarm(TimedAlarm);
+        TimedAlarmUs = Timed[0].atUs;
+        const uint64_t atUs = time_us_64() + int32_t(TimedAlarmUs - time_us_32());
+        TimedAlarm = add_alarm_at(from_us_since_boot(atUs), on_timed_alarm, nullptr, false);
+        // 0 means it was due by the time it got there; go round again and send it
+        if (TimedAlarm > 0)
+            return;
+        TimedAlarm = 0;
+    }
+}
+
+int64_t on_timed_alarm(alarm_id_t, void*)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    TimedAlarm = 0;
+    arm_timed();
+    restore_interrupts(savedIntrMask);
+    return 0;
+}
+
+bool queue_timed(uint32_t atUs, const uint8_t* message, uint32_t len)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    if (NumTimed == MidiMaxTimedMessages)
+    {
+        ++TxStats.messagesDropped;
+        restore_interrupts(savedIntrMask);
+        return false;
+    }
+
+    // after everything due at or before it, so messages for the same time stay in order
+    uint ix = NumTimed;
+    while (ix > 0 && int32_t(Timed[ix - 1].atUs - atUs) > 0)
+        --ix;
+    std::copy_backward(Timed + ix, Timed + NumTimed, Timed + NumTimed + 1);
+    Timed[ix] = { atUs, uint8_t(len), { message[0], message[1], message[2] } };
+    ++NumTimed;
+
+    arm_timed();
+    restore_interrupts(savedIntrMask);
+    return true;
+}
+
+void __not_in_flash_func(on_uart_irq)()
+{
+    drain_rx();
+    feed_tx();
+}
+
+
+// NB. clock out runs from its alarm's irq, or with interrupts disabled, and is in ram too. the
+// alarm's driven through its registers, as the sdk's calls for it aren't inline
+
+void __not_in_flash_func(add_clock_stats)(uint32_t tickUs, uint32_t dueUs)
+{
+    const uint32_t lateUs = tickUs - dueUs;
+    keep_max(ClockStats.maxLateUs, lateUs);
+
+    if (ClockStats.ticks)
+    {
+        const uint32_t intervalUs = tickUs - ClockLastTickUs;
+        const uint32_t dueIntervalUs = dueUs - ClockLastDueUs;
+        const uint32_t jitterUs = (intervalUs > dueIntervalUs) ? intervalUs - dueIntervalUs : dueIntervalUs - intervalUs;
+        if (ClockStats.ticks == 1 || intervalUs < ClockStats.minIntervalUs)
+            ClockStats.minIntervalUs = intervalUs;
+        keep_max(ClockStats.maxIntervalUs, intervalUs);
+        keep_max(ClockStats.maxJitterUs, jitterUs);
+        ClockStats.totalJitterUs += jitterUs;
+    }
+    ClockLastTickUs = tickUs;
+    ClockLastDueUs = dueUs;
+    ++ClockStats.ticks;
+}
+
+void __not_in_flash_func(send_clock_tick)()
+{
+    const uint32_t nowUs = time_us_32();
+    const uint8_t bytes[2] = { 0xf8, ClockTransport };
+    const uint32_t len = ClockTransport ? 2 : 1;
+    ClockTransport = 0;
+
+    // the tick goes out as soon as whatever's in the fifo has; feed_tx made sure that's nothing
+    uint32_t tickUs = nowUs;
+    if (Ports & MidiPort_Din)
+    {
+        uart_hw_t* hw = uart_get_hw(MidiUartBlock);
+        if (int32_t(TxFifoDryUs - nowUs) > 0)
+            tickUs = TxFifoDryUs;
+
+        uint32_t sent = 0;
+        for (; sent<len && uart_is_writable(MidiUartBlock); ++sent)
+            hw->dr = bytes[sent];
+        if (!sent)
+            ++ClockStats.missed;
+
+        TxFifoDryUs = tickUs + sent * MidiByteTimeUs;
+        TxStats.bytesSent += sent;
+        if (int32_t(TxWireFreeUs - nowUs) < 0)
+            TxWireFreeUs = nowUs;
+        TxWireFreeUs += sent * MidiByteTimeUs;
+    }
+    if (Ports & MidiPort_Usb)
+        ClockSentForUsb.push(bytes, len);
+
+    add_clock_stats(tickUs, ClockNextUs);
+
+    if (ClockRunning)
+        ++ClockSongTicks;
+    if (bytes[1] == 0xfa)
+        ClockSongTicks = 0;
+    if (bytes[1])
+        ClockRunning = bytes[1] != 0xfc;
+}
+
+void __not_in_flash_func(on_clock_irq)()
+{
+    timer_hw->intr = 1u << ClockAlarmNum;
+
+    // a tick that's come due goes out, and the alarm moves on to the next one; if that's gone by
+    // already (a long irq elsewhere), it goes out late rather than waiting for the timer to wrap
+    while (ClockEnabled)
+    {
+        if (int32_t(time_us_32() - ClockNextUs) >= 0)
+        {
+            send_clock_tick();
+            const uint32_t nextQ8 = ClockNextFracQ8 + ClockPeriodQ8;
+            ClockNextUs += nextQ8 >> 8;
+            ClockNextFracQ8 = nextQ8 & 0xff;
+            continue;
+        }
+
+        timer_hw->alarm[ClockAlarmNum] = ClockNextUs;
+        if (int32_t(ClockNextUs - time_us_32()) > 0)
+            break;
+        timer_hw->armed = 1u << ClockAlarmNum;
+    }
+
+    // lets go of anything that was held for the tick
+    feed_tx();
+}
 
 };
 
@@ -18,32 +554,304 @@ void midi_init(uart_inst_t* block, uint8_t txGpio, uint8_t rxGpio)
     uart_init(MidiUartBlock, 31250);
     gpio_set_function(txGpio, GPIO_FUNC_UART);
     gpio_set_function(rxGpio, GPIO_FUNC_UART);
+
+    RunningStatus = 0;
+
+    // rx raises the irq once the fifo's 1/8 full, or once it's sat idle for 32 bit times with
+    // anything in it, so a lone byte isn't left waiting for company
+    const uint irq = midi_get_irq();
+    uart_set_irq_enables(MidiUartBlock, true, false);
+    hw_set_bits(&uart_get_hw(MidiUartBlock)->imsc, UART_UARTIMSC_RTIM_BITS);
+    irq_set_exclusive_handler(irq, on_uart_irq);
+    irq_set_enabled(irq, true);
+
+    ClockAlarmNum = uint(hardware_alarm_claim_unused(true));
+    const uint clockIrq = midi_get_clock_irq();
+    hw_set_bits(&timer_hw->inte, 1u << ClockAlarmNum);
+    irq_set_exclusive_handler(clockIrq, on_clock_irq);
+    irq_set_enabled(clockIrq, true);
 }
 
-void midi_note_on(uint8_t channel, uint8_t note, uint8_t vel)
+bool midi_note_on(uint8_t channel, uint8_t note, uint8_t vel)
 {
     uint8_t message[3] = { uint8_t(0x90 | channel), note, vel };
-    uart_write_blocking(MidiUartBlock, message, 3);
     printf(">NOTEON:%d,%d,%d\n", int(channel), int(note), int(vel));
+    return queue_message(message, 3);
 }
 
-void midi_note_off(uint8_t channel, uint8_t note)
+bool midi_note_off(uint8_t channel, uint8_t note)
 {
-    uint8_t message[3] = { uint8_t(0x80 | channel), note, 0 };
-    uart_write_blocking(MidiUartBlock, message, 3);
+    // a note on with zero velocity is a note off, and keeps the running status going
+    const uint8_t status = RunningStatusEnabled ? uint8_t(0x90 | channel) : uint8_t(0x80 | channel);
+    uint8_t message[3] = { status, note, 0 };
     printf(">NOTEOFF:%d,%d\n", int(channel), int(note));
+    return queue_message(message, 3);
 }
 
-void midi_pitchbend(uint8_t channel, uint16_t pitchbend)
+bool midi_note_on_at(uint32_t atUs, uint8_t channel, uint8_t note, uint8_t vel)
+{
+    uint8_t message[3] = { uint8_t(0x90 | channel), note, vel };
+    printf(">NOTEON@%u:%d,%d,%d\n", uint(atUs), int(channel), int(note), int(vel));
+    return queue_timed(atUs, message, 3);
+}
+
+bool midi_note_off_at(uint32_t atUs, uint8_t channel, uint8_t note)
+{
+    const uint8_t status = RunningStatusEnabled ? uint8_t(0x90 | channel) : uint8_t(0x80 | channel);
+    uint8_t message[3] = { status, note, 0 };
+    printf(">NOTEOFF@%u:%d,%d\n", uint(atUs), int(channel), int(note));
+    return queue_timed(atUs, message, 3);
+}
+
+void midi_cancel_timed()
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    NumTimed = 0;
+    arm_timed();
+    restore_interrupts(savedIntrMask);
+}
+
+void midi_update()
+{
+    TimedMessage sent;
+    while (TimedSentForUsb.pop(sent))
+        usb_midi_queue(sent.message, sent.len);
+
+    uint8_t realtime;
+    while (ClockSentForUsb.pop(realtime))
+        usb_midi_queue(&realtime, 1);
+}
+
+
+void midi_clock_enable(bool enabled)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    const bool wasRunning = ClockRunning;
+    if (enabled && !ClockEnabled)
+    {
+        ClockEnabled = true;
+        ClockNextUs = time_us_32() + (ClockPeriodQ8 >> 8);
+        ClockNextFracQ8 = 0;
+        ClockStats = MidiClockStats{};
+        timer_hw->alarm[ClockAlarmNum] = ClockNextUs;
+    }
+    else if (!enabled && ClockEnabled)
+    {
+        ClockEnabled = false;
+        timer_hw->armed = 1u << ClockAlarmNum;
+        ClockTransport = 0;
+        ClockRunning = false;
+        feed_tx();
+    }
+    restore_interrupts(savedIntrMask);
+
+    // anything following along would otherwise sit waiting for the next tick
+    if (!enabled && wasRunning)
+    {
+        const uint8_t stop = 0xfc;
+        queue_message(&stop, 1);
+    }
+}
+
+void midi_clock_set_bpm(float bpm)
+{
+    const uint32_t periodQ8 = uint32_t((60.0f * 1000 * 1000 * 256) / (std::max(bpm, 1.0f) * MidiClockTicksPerBeat));
+
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    if (periodQ8 != ClockPeriodQ8)
+    {
+        ClockPeriodQ8 = periodQ8;
+        ClockStats = MidiClockStats{};
+    }
+    restore_interrupts(savedIntrMask);
+}
+
+void midi_clock_start()
+{
+    ClockTransport = 0xfa;
+}
+
+void midi_clock_continue()
+{
+    ClockTransport = 0xfb;
+}
+
+void midi_clock_stop()
+{
+    ClockTransport = 0xfc;
+}
+
+bool midi_clock_is_running()
+{
+    return ClockRunning;
+}
+
+bool midi_clock_set_song_position(uint16_t sixteenths)
+{
+    if (ClockRunning || ClockTransport)
+        return false;
+
+    sixteenths = std::min<uint16_t>(sixteenths, 0x3fff);
+    ClockSongTicks = sixteenths * MidiClockTicksPerSixteenth;
+    const uint8_t message[3] = { 0xf2, uint8_t(sixteenths & 0x7f), uint8_t(sixteenths >> 7) };
+    return queue_message(message, 3);
+}
+
+uint16_t midi_clock_get_song_position()
+{
+    return uint16_t((ClockSongTicks / MidiClockTicksPerSixteenth) & 0x3fff);
+}
+
+uint midi_get_clock_irq()
+{
+    return TIMER_IRQ_0 + ClockAlarmNum;
+}
+
+const MidiClockStats& midi_get_clock_stats()
+{
+    return ClockStats;
+}
+
+void midi_reset_clock_stats()
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    ClockStats = MidiClockStats{};
+    restore_interrupts(savedIntrMask);
+}
+
+bool midi_pitchbend(uint8_t channel, uint16_t pitchbend)
 {
     uint8_t lsb = uint8_t(pitchbend & 0x7f);
     uint8_t msb = uint8_t(pitchbend >> 7);
     uint8_t message[3] = { uint8_t(0xe0 | channel), lsb, msb };
-    uart_write_blocking(MidiUartBlock, message, 3);
     //printf(">PB:%d,%d, %02x:%02x\n", int(channel), int(pitchbend), int(msb), int(lsb));
+    return queue_message(message, 3);
 }
-void midi_cc(uint8_t channel, uint8_t cc, uint8_t val)
+bool midi_cc(uint8_t channel, uint8_t cc, uint8_t val)
 {
     uint8_t message[3] = { uint8_t(0xB0 | channel), cc, val };
-    uart_write_blocking(MidiUartBlock, message, 3);
+    return queue_message(message, 3);
+}
+
+
+void midi_set_ports(uint8_t ports)
+{
+    Ports = ports;
+}
+
+void midi_set_thru(bool enabled)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    if (!enabled && ThruInSysex)
+        end_thru_sysex();
+    ThruEnabled = enabled;
+    ThruStatus = 0;
+    ThruHave = 0;
+    restore_interrupts(savedIntrMask);
+}
+
+const MidiThruStats& midi_get_thru_stats()
+{
+    return ThruStats;
+}
+
+void midi_reset_thru_stats()
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    ThruStats = MidiThruStats{};
+    restore_interrupts(savedIntrMask);
+}
+
+void midi_set_running_status(bool enabled, uint32_t refreshMs)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    RunningStatusEnabled = enabled;
+    RunningStatusRefreshMs = refreshMs;
+    RunningStatus = 0;
+    restore_interrupts(savedIntrMask);
+}
+
+void midi_flush()
+{
+    while (!TxQueue.empty())
+        tight_loop_contents();
+
+    uart_tx_wait_blocking(MidiUartBlock);
+}
+
+uint midi_get_irq()
+{
+    return (MidiUartBlock == uart0) ? UART0_IRQ : UART1_IRQ;
+}
+
+uint32_t midi_tx_queued()
+{
+    return TxQueue.size();
+}
+
+uint32_t midi_tx_backlog_us()
+{
+    // nothing of ours goes out until an incoming sysex is done, and there's no telling when that'll be
+    if (ThruInSysex)
+        return MidiThruSysexTimeoutMs * 1000;
+
+    const int32_t backlogUs = int32_t(TxWireFreeUs - time_us_32());
+    return (backlogUs > 0) ? uint32_t(backlogUs) : 0;
+}
+
+const MidiTxStats& midi_get_tx_stats()
+{
+    return TxStats;
+}
+
+void midi_reset_tx_stats()
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    TxStats = MidiTxStats{};
+    restore_interrupts(savedIntrMask);
+}
+
+
+void midi_rx_update(MidiParser& parser)
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    drain_rx();
+    if (ThruInSysex && time_us_32() - ThruSysexLastUs > MidiThruSysexTimeoutMs * 1000)
+        end_thru_sysex();
+    restore_interrupts(savedIntrMask);
+
+    // at most two runs; one up to where the queue wraps and one after. anything that comes in
+    // meanwhile can wait for the next pass
+    for (uint run=0; run<2; ++run)
+    {
+        const uint8_t* bytes;
+        const uint32_t len = RxQueue.peekContiguous(bytes);
+        if (!len)
+            break;
+
+        parser.parse(bytes, len);
+        RxQueue.drop(len);
+    }
+}
+
+bool midi_rx_take_clock_time(uint32_t& outUs)
+{
+    return RxClockTimes.pop(outUs);
+}
+
+uint32_t midi_rx_queued()
+{
+    return RxQueue.size();
+}
+
+const MidiRxStats& midi_get_rx_stats()
+{
+    return RxStats;
+}
+
+void midi_reset_rx_stats()
+{
+    uint32_t savedIntrMask = save_and_disable_interrupts();
+    RxStats = MidiRxStats{};
+    restore_interrupts(savedIntrMask);
 }
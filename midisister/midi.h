@@ -5,9 +5,136 @@
 #include "hardware/uart.h"
 
 
+struct MidiTxStats
+{
+    uint32_t bytesQueued = 0;
+    uint32_t bytesSent = 0;
+    uint32_t messagesDropped = 0;   // messages that didn't fit in the tx queue
+    uint32_t peakQueued = 0;        // high water mark of the tx queue, in bytes
+    uint32_t bytesSaved = 0;        // status bytes elided by running status
+    uint32_t maxGapUs = 0;          // longest the wire sat idle with bytes waiting to go
+};
+
+struct MidiRxStats
+{
+    uint32_t bytesReceived = 0;
+    uint32_t bytesDropped = 0;      // didn't fit in the rx queue (or, for a clock, its time didn't)
+    uint32_t lineErrors = 0;        // framing errors, breaks & uart fifo overruns
+    uint32_t peakQueued = 0;        // high water mark of the rx queue, in bytes
+};
+
+struct MidiThruStats
+{
+    uint32_t messages = 0;          // forwarded from the din input, realtime included
+    uint32_t sysexBytes = 0;
+    uint32_t dropped = 0;           // messages & sysex bytes that didn't fit in the tx queue
+    uint32_t held = 0;              // of ours that waited for an incoming sysex to finish
+    uint32_t maxAddedUs = 0;        // longest a message waited behind what was already queued
+    uint64_t totalAddedUs = 0;
+};
+
+struct MidiClockStats
+{
+    uint32_t ticks = 0;
+    uint32_t minIntervalUs = 0;     // between ticks going out on the wire
+    uint32_t maxIntervalUs = 0;
+    uint32_t maxJitterUs = 0;       // furthest an interval was from the tempo's
+    uint64_t totalJitterUs = 0;
+    uint32_t maxLateUs = 0;         // furthest a tick went out after it was due
+    uint32_t missed = 0;            // ticks the uart's fifo had no room for
+};
+
+class MidiParser;
+
+
+// each byte on the wire is a start bit, 8 data bits and a stop bit at 31250 baud
+constexpr uint32_t MidiByteTimeUs = 320;
+
+
 void midi_init(uart_inst_t* block = uart0, uint8_t txGpio = 0, uint8_t rxGpio = 1);
 
-void midi_note_on(uint8_t channel, uint8_t note, uint8_t vel = 127);
-void midi_note_off(uint8_t channel, uint8_t note);
-void midi_pitchbend(uint8_t channel, uint16_t pitchbend);
-void midi_cc(uint8_t channel, uint8_t cc, uint8_t val);
+// every message goes out of each enabled port; the config's PORTS picks them
+enum MidiPort : uint8_t
+{
+    MidiPort_Din = 1 << 0,
+    MidiPort_Usb = 1 << 1,     // see usb_midi.h
+    MidiPort_All = MidiPort_Din | MidiPort_Usb,
+};
+void midi_set_ports(uint8_t ports);
+// the tx irq handler, and everything it touches, is in ram; it can be left enabled while flash
+// is busy so the queue keeps draining
+uint midi_get_irq();
+
+// thru merges the din input into the din output. each incoming message is rebuilt from the input's
+// running status as it arrives and goes out whole between ours, under the output's running status;
+// realtime goes straight out. an incoming sysex is passed along byte by byte, and anything of
+// ours for din waits until it's done (or has been quiet for MidiThruSysexTimeoutMs)
+constexpr uint32_t MidiThruSysexTimeoutMs = 100;
+void midi_set_thru(bool enabled);
+const MidiThruStats& midi_get_thru_stats();
+void midi_reset_thru_stats();
+
+// clock out sends 24 ticks to the beat out of each enabled port, from a hardware alarm of its own
+// (see midi_get_clock_irq). just before each tick nothing more is fed to the uart, so the wire's
+// idle when the tick goes straight into it; it can cut into one of our messages, so it never
+// waits behind one. ticks keep coming whenever it's enabled; start, continue & stop go out right
+// after the next one, so the one after that is the first that counts. while it's enabled, thru
+// doesn't pass on any clock, start, continue or stop coming in
+constexpr uint MidiClockTicksPerBeat = 24;
+constexpr uint MidiClockTicksPerSixteenth = 6;
+void midi_clock_enable(bool enabled);
+void midi_clock_set_bpm(float bpm);
+void midi_clock_start();
+void midi_clock_continue();
+void midi_clock_stop();
+bool midi_clock_is_running();
+// in sixteenths from the start of the song, as the song position pointer counts; it's sent
+// straight away, so it can only be moved while stopped
+bool midi_clock_set_song_position(uint16_t sixteenths);
+uint16_t midi_clock_get_song_position();
+uint midi_get_clock_irq();
+const MidiClockStats& midi_get_clock_stats();
+void midi_reset_clock_stats();
+
+// running status drops the status byte when it matches the last one sent; it's resent at least
+// every refreshMs so that a receiver that missed it (or was plugged in late) picks it back up.
+// while enabled, note offs are sent as velocity 0 note ons so they share the note on status
+constexpr uint32_t MidiRunningStatusRefreshMs = 500;
+void midi_set_running_status(bool enabled, uint32_t refreshMs = MidiRunningStatusRefreshMs);
+
+// NB. these never block; messages are queued and sent from the uart irq (or by usb_midi_update).
+//  they return false (and count a drop) if the tx queue is full
+bool midi_note_on(uint8_t channel, uint8_t note, uint8_t vel = 127);
+bool midi_note_off(uint8_t channel, uint8_t note);
+bool midi_pitchbend(uint8_t channel, uint16_t pitchbend);
+bool midi_cc(uint8_t channel, uint8_t cc, uint8_t val);
+
+// the same, but queued from a hardware alarm at atUs, so they go out on time however busy the
+// loop is; they can be up to ~50ms late while flash is being written, as the alarm's held off
+//  messages due at the same time keep the order they were queued in
+constexpr uint MidiMaxTimedMessages = 16;
+bool midi_note_on_at(uint32_t atUs, uint8_t channel, uint8_t note, uint8_t vel = 127);
+bool midi_note_off_at(uint32_t atUs, uint8_t channel, uint8_t note);
+// drops everything that hasn't gone yet
+void midi_cancel_timed();
+// hands timed messages that have gone out on to usb; call every loop
+void midi_update();
+
+// blocks until everything queued has left the uart
+void midi_flush();
+
+uint32_t midi_tx_queued();
+// how long until everything queued so far has left the wire
+uint32_t midi_tx_backlog_us();
+const MidiTxStats& midi_get_tx_stats();
+void midi_reset_tx_stats();
+
+// the uart irq queues whatever comes in on rx; this hands everything queued so far to the
+// parser, straight out of the queue. it also picks up anything still in the uart's fifo, so thru
+// doesn't wait on the irq's fifo level or timeout; call every loop
+void midi_rx_update(MidiParser& parser);
+// when each clock (f8) came in, in order; take one as the parser hands over each clock
+bool midi_rx_take_clock_time(uint32_t& outUs);
+uint32_t midi_rx_queued();
+const MidiRxStats& midi_get_rx_stats();
+void midi_reset_rx_stats();
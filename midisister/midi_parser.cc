@@ -0,0 +1,149 @@
+#include "midi_parser.h"
+
+
+// the common case, data for a message in progress, drops straight through to onData; sysex
+// data isn't looked at at all, just handed over as a run once something ends it
+void MidiParser::parse(const uint8_t* bytes, uint32_t len)
+{
+    const uint8_t* const end = bytes + len;
+    const uint8_t* sysexFrom = bytes;   // start of the sysex that's not been handed over yet
+
+    for (const uint8_t* curr = bytes; curr != end; ++curr)
+    {
+        const uint8_t b = *curr;
+        if (b < 0x80)
+        {
+            if (!m_inSysex)
+                onData(b);
+            continue;
+        }
+
+        if (b >= 0xf8)
+        {
+            // realtime doesn't disturb anything, but it does split the sysex around it
+            if (m_inSysex)
+            {
+                onSysex(sysexFrom, curr, 0);
+                sysexFrom = curr + 1;
+            }
+
+            ++m_stats.realtime;
+            if (m_handlers.onRealtime)
+                m_handlers.onRealtime(b);
+            continue;
+        }
+
+        if (m_inSysex)
+        {
+            // f7 is the proper end, but any status byte finishes it
+            m_inSysex = false;
+            if (b == 0xf7)
+            {
+                onSysex(sysexFrom, curr, MidiSysex_End);
+                continue;
+            }
+
+            ++m_stats.truncated;
+            onSysex(sysexFrom, curr, MidiSysex_End | MidiSysex_Aborted);
+        }
+
+        onStatus(b);
+        if (m_inSysex)
+            sysexFrom = curr + 1;
+    }
+
+    if (m_inSysex)
+        onSysex(sysexFrom, end, 0);
+}
+
+void MidiParser::reset()
+{
+    if (m_inSysex)
+    {
+        ++m_stats.truncated;
+        onSysex(nullptr, nullptr, MidiSysex_End | MidiSysex_Aborted);
+    }
+
+    m_status = 0;
+    m_needed = 0;
+    m_have = 0;
+    m_inSysex = false;
+}
+
+
+void MidiParser::onStatus(uint8_t status)
+{
+    if (m_have)
+        ++m_stats.truncated;
+    m_have = 0;
+
+    if (status == 0xf0)
+    {
+        m_inSysex = true;
+        m_sysexStarted = false;
+        m_status = 0;
+        return;
+    }
+
+    if (status == 0xf7)
+    {
+        ++m_stats.strayBytes;
+        m_status = 0;
+        return;
+    }
+
+    // system common messages cancel running status; the undefined ones (f4 & f5) are dropped
+    m_status = status;
+    m_needed = midi_data_len(status);
+    if (m_needed == 0)
+    {
+        m_status = 0;
+        if (status == 0xf6)
+        {
+            ++m_stats.messages;
+            if (m_handlers.onMessage)
+                m_handlers.onMessage(MidiMessage{ status, { 0, 0 }, 0 });
+        }
+    }
+}
+
+void MidiParser::onData(uint8_t data)
+{
+    if (!m_status)
+    {
+        ++m_stats.strayBytes;
+        return;
+    }
+
+    m_data[m_have++] = data;
+    if (m_have < m_needed)
+        return;
+
+    const MidiMessage msg = { m_status, { m_data[0], (m_needed > 1) ? m_data[1] : uint8_t(0) }, m_needed };
+    m_have = 0;
+    // only channel messages carry on into running status
+    if (m_status >= 0xf0)
+        m_status = 0;
+
+    ++m_stats.messages;
+    if (m_handlers.onMessage)
+        m_handlers.onMessage(msg);
+}
+
+void MidiParser::onSysex(const uint8_t* from, const uint8_t* to, uint8_t flags)
+{
+    const uint32_t len = uint32_t(to - from);
+    if (!m_sysexStarted)
+    {
+        flags |= MidiSysex_Start;
+        m_sysexStarted = true;
+    }
+    else if (len == 0 && !(flags & MidiSysex_End))
+    {
+        return;
+    }
+
+    m_stats.sysexBytes += len;
+    if (m_handlers.onSysex)
+        m_handlers.onSysex(from, len, flags);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/stdlib.h"
+
+
+// how many data bytes follow a status; system common messages that aren't defined take none
+// forced inline, as midi thru uses it from the uart irq, which runs from ram while flash is busy
+__force_inline constexpr uint8_t midi_data_len(uint8_t status)
+{
+    switch (status & 0xf0)
+    {
+        case 0xc0: case 0xd0:   return 1;
+        case 0xf0:
+            if (status == 0xf1 || status == 0xf3) return 1;
+            if (status == 0xf2) return 2;
+            return 0;
+        default:                return 2;
+    }
+}
+
+
+// a complete channel or system common message
+struct MidiMessage
+{
+    uint8_t status;
+    uint8_t data[2];    // any the message doesn't use are 0
+    uint8_t length;     // of data
+
+    uint8_t getType() const     { return status & 0xf0; }
+    uint8_t getChannel() const  { return status & 0x0f; }
+};
+
+enum MidiSysexFlags : uint8_t
+{
+    MidiSysex_Start   = 1 << 0,     // the first piece of a message
+    MidiSysex_End     = 1 << 1,     // the last piece
+    MidiSysex_Aborted = 1 << 2,     // along with End; another status byte cut it short
+};
+
+// the parser calls these as each event completes; any of them can be left null
+struct MidiHandlers
+{
+    void (*onMessage)(const MidiMessage& msg) = nullptr;
+    // clock, start, stop etc; these can turn up between any two bytes, even in the middle of a message
+    void (*onRealtime)(uint8_t status) = nullptr;
+    // sysex is handed over in pieces as it arrives, without the f0 & f7; data points straight into
+    // what was given to parse(), so it's only valid for the call
+    void (*onSysex)(const uint8_t* data, uint32_t len, uint8_t flags) = nullptr;
+};
+
+struct MidiParserStats
+{
+    uint32_t messages = 0;
+    uint32_t realtime = 0;
+    uint32_t sysexBytes = 0;
+    uint32_t strayBytes = 0;        // data bytes with no status to go with them, and lone f7s
+    uint32_t truncated = 0;         // messages (& sysex) cut short by another status byte
+};
+
+
+// incremental midi byte stream parser; takes the bytes in whatever sized pieces they come, and
+// handles running status, realtime bytes interleaved anywhere and sysex of any length
+class MidiParser
+{
+public:
+    explicit MidiParser(const MidiHandlers& handlers) : m_handlers(handlers) {}
+
+    void parse(const uint8_t* bytes, uint32_t len);
+    // forgets any partial message & the running status, e.g. when the input's been lost
+    void reset();
+
+    const MidiParserStats& getStats() const    { return m_stats; }
+    void resetStats()                           { m_stats = MidiParserStats{}; }
+
+private:
+    void onStatus(uint8_t status);
+    void onData(uint8_t data);
+    void onSysex(const uint8_t* from, const uint8_t* to, uint8_t flags);
+
+    MidiHandlers m_handlers;
+
+    uint8_t  m_status = 0;          // the running status, or the system common message in progress; 0 => none
+    uint8_t  m_needed = 0;          // data bytes m_status takes
+    uint8_t  m_have = 0;
+    uint8_t  m_data[2] = {};
+    bool     m_inSysex = false;
+    bool     m_sysexStarted = false;    // its first piece has been handed over
+
+    MidiParserStats m_stats;
+};
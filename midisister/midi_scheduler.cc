@@ -0,0 +1,177 @@
+#include "midi_scheduler.h"
+#include "midi.h"
+#include "profile.h"
+
+
+void MidiScheduler::noteOn(uint8_t channel, uint8_t note, uint8_t vel)
+{
+    midi_note_on(channel, note, vel);
+}
+
+void MidiScheduler::noteOff(uint8_t channel, uint8_t note)
+{
+    midi_note_off(channel, note);
+}
+
+void MidiScheduler::noteOnAt(uint32_t atUs, uint8_t channel, uint8_t note, uint8_t vel)
+{
+    midi_note_on_at(atUs, channel, note, vel);
+}
+
+void MidiScheduler::noteOffAt(uint32_t atUs, uint8_t channel, uint8_t note)
+{
+    midi_note_off_at(atUs, channel, note);
+}
+
+void MidiScheduler::cancelTimed()
+{
+    midi_cancel_timed();
+}
+
+void MidiScheduler::controlChange(uint8_t channel, uint8_t cc, uint8_t val, uint32_t minIntervalUs)
+{
+    setPending(uint8_t(0xb0 | channel), Kind::Plain, cc, val, minIntervalUs);
+}
+
+void MidiScheduler::pitchBend(uint8_t channel, uint16_t val, uint32_t minIntervalUs)
+{
+    setPending(uint8_t(0xe0 | channel), Kind::Plain, 0, val, minIntervalUs);
+}
+
+void MidiScheduler::controlChange14(uint8_t channel, uint8_t cc, uint16_t val, uint32_t minIntervalUs)
+{
+    setPending(uint8_t(0xb0 | channel), Kind::Cc14, cc, val, minIntervalUs);
+}
+
+void MidiScheduler::nrpn(uint8_t channel, uint16_t param, uint16_t val, uint32_t minIntervalUs)
+{
+    setPending(uint8_t(0xb0 | channel), Kind::Nrpn, param, val, minIntervalUs);
+}
+
+
+void MidiScheduler::setPending(uint8_t status, Kind kind, uint16_t param, uint16_t val, uint32_t minIntervalUs)
+{
+    Slot* slot = nullptr;
+    for (uint i=0; i<m_numSlots; ++i)
+    {
+        if (m_slots[i].status == status && m_slots[i].kind == kind && m_slots[i].param == param)
+        {
+            slot = &m_slots[i];
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        if (m_numSlots == MaxSlots)
+        {
+            // nowhere to coalesce it; better late than never
+            Slot direct = { status, kind, param, true, val, uint16_t(~val), 0, 0 };
+            send(direct);
+            return;
+        }
+
+        slot = &m_slots[m_numSlots];
+        ++m_numSlots;
+        *slot = { status, kind, param, false, val, uint16_t(~val), 0, time_us_32() - minIntervalUs };
+    }
+
+    slot->val = val;
+    slot->minIntervalUs = minIntervalUs;
+    slot->pending = (val != slot->sentVal);
+}
+
+bool MidiScheduler::send(Slot& slot)
+{
+    const uint8_t channel = slot.status & 0x0f;
+    switch (slot.kind)
+    {
+        case Kind::Plain:
+        {
+            const bool sent = ((slot.status & 0xf0) == 0xe0)
+                ? midi_pitchbend(channel, slot.val)
+                : midi_cc(channel, uint8_t(slot.param), uint8_t(slot.val));
+            if (sent)
+                slot.sentVal = slot.val;
+            return sent;
+        }
+
+        case Kind::Cc14:
+            return send14(channel, uint8_t(slot.param), uint8_t(slot.param + 32), slot);
+
+        case Kind::Nrpn:
+        {
+            uint16_t& selected = m_selectedNrpn[channel];
+            if (selected != slot.param)
+            {
+                // the data entry that follows goes to whichever parameter's selected, so if the
+                // selection's only half done it's anybody's guess until it's redone
+                selected = NoNrpn;
+                if (!midi_cc(channel, 99, uint8_t(slot.param >> 7)) || !midi_cc(channel, 98, uint8_t(slot.param & 0x7f)))
+                    return false;
+
+                // a different parameter, so its data has to go in full
+                selected = slot.param;
+                slot.sentVal = uint16_t(~slot.val);
+            }
+            return send14(channel, 6, 38, slot);
+        }
+    }
+    return false;
+}
+
+// all ccs on the same channel, back to back, so running status covers everything after the first
+bool MidiScheduler::send14(uint8_t channel, uint8_t msbCc, uint8_t lsbCc, Slot& slot)
+{
+    const uint8_t msb = uint8_t((slot.val >> 7) & 0x7f);
+    const uint8_t lsb = uint8_t(slot.val & 0x7f);
+
+    if (slot.sentVal >> 7 != msb)
+    {
+        if (!midi_cc(channel, msbCc, msb))
+            return false;
+        slot.sentVal = uint16_t(msb << 7);
+    }
+
+    if ((slot.sentVal & 0x7f) != lsb)
+    {
+        if (!midi_cc(channel, lsbCc, lsb))
+            return false;
+    }
+
+    slot.sentVal = slot.val;
+    return true;
+}
+
+
+void MidiScheduler::update()
+{
+    PROFILE_STAGE(Midi);
+
+    if (!m_numSlots)
+        return;
+
+    const uint32_t nowUs = time_us_32();
+    for (uint checked=0; checked<m_numSlots && midi_tx_backlog_us() < BacklogBudgetUs; ++checked)
+    {
+        Slot& slot = m_slots[m_nextSlot];
+        m_nextSlot = (m_nextSlot + 1) % m_numSlots;
+
+        if (!slot.pending || (nowUs - slot.lastSentUs) < slot.minIntervalUs)
+            continue;
+
+        if (!send(slot))
+            return;
+
+        slot.pending = false;
+        slot.lastSentUs = nowUs;
+    }
+}
+
+void MidiScheduler::reset()
+{
+    m_numSlots = 0;
+    m_nextSlot = 0;
+    for (uint16_t& selected : m_selectedNrpn)
+        selected = NoNrpn;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include "util.h"
+
+
+// sits between the mapping loop and midi.cc:
+//  * notes go straight to the tx queue, so they're never stuck behind controller traffic
+//  * controllers get one slot per destination where the latest value wins; slots are only
+//    released while the wire backlog is under budget, so bursts coalesce instead of queueing
+class MidiScheduler
+{
+public:
+    static constexpr uint MaxSlots = 16;
+    // roughly one message of backlog; a note waits at most this long behind controllers
+    static constexpr uint32_t BacklogBudgetUs = 1000;
+
+    void noteOn(uint8_t channel, uint8_t note, uint8_t vel = 127);
+    void noteOff(uint8_t channel, uint8_t note);
+    // the same, but sent at atUs from a timer; see midi_note_on_at
+    void noteOnAt(uint32_t atUs, uint8_t channel, uint8_t note, uint8_t vel = 127);
+    void noteOffAt(uint32_t atUs, uint8_t channel, uint8_t note);
+    void cancelTimed();
+
+    // minIntervalUs rate limits the destination; 0 => as fast as the wire allows
+    void controlChange(uint8_t channel, uint8_t cc, uint8_t val, uint32_t minIntervalUs = 0);
+    void pitchBend(uint8_t channel, uint16_t val, uint32_t minIntervalUs = 0);
+
+    // 14 bit values, as an msb/lsb pair of ccs (cc & cc + 32) or as an nrpn's data entry
+    //  each half is only sent when the receiver doesn't have it already; a new msb resets the
+    //  receiver's lsb to 0, so that's all it takes to know when the lsb has to follow
+    //  an nrpn's parameter is only selected when it isn't the channel's current one
+    void controlChange14(uint8_t channel, uint8_t cc, uint16_t val, uint32_t minIntervalUs = 0);
+    void nrpn(uint8_t channel, uint16_t param, uint16_t val, uint32_t minIntervalUs = 0);
+
+    // sends whatever pending controllers fit in the budget; call every loop
+    void update();
+
+    // forget everything pending and sent, e.g. after the config changes
+    void reset();
+
+private:
+    enum class Kind : uint8_t
+    {
+        Plain,      // one message carries the whole value
+        Cc14,
+        Nrpn,
+    };
+
+    struct Slot
+    {
+        uint8_t  status;        // 0 => unused
+        Kind     kind;
+        uint16_t param;
+        bool     pending;
+        uint16_t val;
+        uint16_t sentVal;       // what the receiver has, as far as we know
+        uint32_t minIntervalUs;
+        uint32_t lastSentUs;
+    };
+
+    static constexpr uint16_t NoNrpn = 0xffff;
+
+    void setPending(uint8_t status, Kind kind, uint16_t param, uint16_t val, uint32_t minIntervalUs);
+    // updates sentVal as each message goes, so a send that stops part way picks up from there
+    bool send(Slot& slot);
+    bool send14(uint8_t channel, uint8_t msbCc, uint8_t lsbCc, Slot& slot);
+
+private:
+    Slot     m_slots[MaxSlots] = {};
+    uint     m_numSlots = 0;
+    uint     m_nextSlot = 0;    // round robin so a busy destination can't starve the others
+    uint16_t m_selectedNrpn[16] = { NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn,
+                                    NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn, NoNrpn };
+};
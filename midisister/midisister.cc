@@ -5,19 +5,33 @@
 //
 
 #include <algorithm>
+#include <cctype>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <limits>
-#include <vector>
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#if MIDISISTER_DUAL_CORE
+#include "pico/multicore.h"
+#endif
 
+#include "arpeggiator.h"
 #include "config.h"
+#include "ext_clock.h"
 #include "flash_save.h"
+#include "mapping_filter.h"
+#include "mapping_luts.h"
 #include "midi.h"
+#include "midi_parser.h"
+#include "midi_scheduler.h"
 #include "nunchuk.h"
+#include "profile.h"
+#include "ring_buffer.h"
+#include "sample_clock.h"
+#include "usb_midi.h"
 #include "util.h"
 
 using std::begin, std::end;
@@ -34,17 +48,72 @@ uart_inst_t* const UART_Block = uart0;
 constexpr int UART_TX_Gpio = 16;
 constexpr int UART_RX_Gpio = 17;
 
-uint32_t lastMs = 0;
-
 byte ledState = 0;
 
 byte playingNote = 0;
-int lastNoteMs = 0;
-
-Config config;
+uint32_t lastNoteUs = 0;
+Arpeggiator arp;
+
+// each preset is kept parsed & ready; switching between them is just repointing config
+// uploads are parsed into the spare, which then swaps places with the preset it replaces, so
+// the config that's driving the outputs is never written to
+Config configPool[NumPresets + 1];
+Config* presets[NumPresets];
+Config* shadowConfig = &configPool[NumPresets];
+bool presetSaved[NumPresets] = {};
+const Config* config = &configPool[0];
+uint activePreset = 0;
+int pendingPreset = -1;
+int editPreset = -1;        // where 'edit <n>' sent the next upload; otherwise it goes to the live preset
+int pendingUpload = -1;     // preset the shadow config is waiting to replace
+bool uploadOk = false;      // nothing in the upload so far has failed to parse
+uint32_t uploadParseUs = 0; // the longest the loop was held up by any one piece of the upload
+
+MappingLuts mappingLuts;
+MidiScheduler midiScheduler;
 uint16_t lastOutputVals[Config::MaxMappings] = {};
+constexpr uint16_t NoOutputVal = 0xffff;    // never a real value, so the next one always goes out
+MappingFilter mappingFilters[Config::MaxMappings];
+MappingTrafficStats trafficStats;
+SampleClock sampleClock;
+
+#if MIDISISTER_DUAL_CORE
+// only core1 writes the count, so a reset just moves where core0 counts from
+volatile uint32_t droppedSamples = 0;
+uint32_t droppedSamplesAtReset = 0;
+#endif
+
+void onConfigChanged()
+{
+    midi_set_ports(config->getOutputPorts());
+    midi_set_thru(config->isThruEnabled());
+    midi_clock_set_bpm(float(config->getBpm()));
+    midi_clock_enable(config->isClockOutEnabled());
+    sampleClock.setRate(config->getSampleRateHz());
+    midiScheduler.reset();
+    mappingLuts.invalidate();
+    for (MappingFilter& filter : mappingFilters)
+        filter.reset();
+}
+
+// a mapping that still goes to the same place can carry on from its last value; anything else
+// has to send its current value, whatever it is
+void resyncOutputs(const Config& from, const Config& to)
+{
+    const Config::Runtime& fromMappings = from.getRuntime();
+    const Config::Runtime& toMappings = to.getRuntime();
+    const bool sameChannel = from.getChannel() == to.getChannel();
+    for (uint i=0; i<Config::MaxMappings; ++i)
+    {
+        const bool sameDest = sameChannel && i < from.getNumMappings() && i < to.getNumMappings()
+            && fromMappings.destType[i] == toMappings.destType[i]
+            && fromMappings.destParam[i] == toMappings.destParam[i];
+        if (!sameDest)
+            lastOutputVals[i] = NoOutputVal;
+    }
+}
 
-static const char* defaultConfigStr = 
+static constexpr const char* defaultConfigStr = 
 R"END(
     CHAN 1
     ROOT C
@@ -63,6 +132,52 @@ R"END(
     END.
 )END";
 
+// parsed by the compiler, so a mistake in it fails the build; boot & fallback just copy it
+static constexpr Config defaultConfig = Config::fromText(defaultConfigStr);
+
+
+// takes effect at the start of the next frame
+void selectPreset(uint preset)
+{
+    if (preset >= NumPresets)
+    {
+        printf("there's no preset %u; there are %u\n", preset, NumPresets);
+        return;
+    }
+
+    if (!presetSaved[preset])
+        printf("preset %u has nothing saved; it'll run the defaults\n", preset);
+    pendingPreset = int(preset);
+}
+
+// the preset that the next config upload goes to
+uint getEditPreset()
+{
+    if (editPreset >= 0)
+        return uint(editPreset);
+    return (pendingPreset >= 0) ? uint(pendingPreset) : activePreset;
+}
+
+// only picks where the next upload lands; what's playing carries on as it is
+void selectEditPreset(uint preset)
+{
+    if (preset >= NumPresets)
+    {
+        printf("there's no preset %u; there are %u\n", preset, NumPresets);
+        return;
+    }
+
+    editPreset = int(preset);
+}
+
+void loadPreset(uint preset)
+{
+    presets[preset] = &configPool[preset];
+    presetSaved[preset] = load_flash_config(*presets[preset], preset);
+    if (!presetSaved[preset])
+        *presets[preset] = defaultConfig;
+}
+
 
 void hexdump(const void* start, uint len)
 {
@@ -80,138 +195,655 @@ void hexdump(const void* start, uint len)
     }
 }
 
+// the midi input; program changes on our channel pick a preset, and the clock's followed for SYNC ext
+ExtClock extClock;
+
+void onMidiInMessage(const MidiMessage& msg)
+{
+    if (msg.getType() == 0xc0 && msg.getChannel() == config->getChannel())
+    {
+        printf("program change %u\n", uint(msg.data[0]));
+        selectPreset(msg.data[0]);
+    }
+}
+
+void onMidiInRealtime(uint8_t status)
+{
+    switch (status)
+    {
+        case 0xf8:  // clock
+        {
+            uint32_t tickUs;
+            if (!midi_rx_take_clock_time(tickUs))
+                tickUs = time_us_32();
+            extClock.onTick(tickUs);
+            break;
+        }
+
+        case 0xfa:  extClock.onStart();     break;
+        case 0xfb:  extClock.onContinue();  break;
+        case 0xfc:  extClock.onStop();      break;
+    }
+}
+
+MidiParser midiIn({ onMidiInMessage, onMidiInRealtime, nullptr });
+
+void updateMidiIn()
+{
+    PROFILE_STAGE(MidiIn);
+    midi_rx_update(midiIn);
+    extClock.update(time_us_32());
+}
+
+
 constexpr uint MaxConfigSize = 4 * 1024;
 char configBuf[MaxConfigSize] = {};
+void applyPendingConfig();
 void onLineRead(const char* line)
 {
     printf("read line '%s'\n", line);
     if (strncmp("dump", line, 4) == 0 && configBuf[0] == 0)
     {
-        if (is_flash_save_valid())
-            printf("saved config:--\n%s\n----------\n", get_flash_save_data());
+        if (is_flash_save_valid(activePreset))
+            printf("saved config for preset %u:--\n%s\n----------\n", activePreset, get_flash_save_data(activePreset));
         else
             puts("no data saved in flash");
         return;
     }
     else if (strncmp("hdmp", line, 4) == 0 && configBuf[0] == 0)
     {
-        constexpr ptrdiff_t Flash_SaveBufOffset = (2*1024*1024) - (100*1024);
         const uint8_t* saveBuf = (const uint8_t*)(XIP_BASE + Flash_SaveBufOffset);
         hexdump(saveBuf, 512 + 64);
     }
+    else if (strncmp("preset", line, 6) == 0 && configBuf[0] == 0)
+    {
+        const char* arg = line + 6;
+        while (*arg == ' ')
+            ++arg;
+
+        if (isdigit(*arg))
+        {
+            selectPreset(uint(atoi(arg)));
+        }
+        else
+        {
+            printf("preset %u active; saved:", activePreset);
+            for (uint i=0; i<NumPresets; ++i)
+            {
+                if (presetSaved[i])
+                    printf(" %u", i);
+            }
+            puts("");
+        }
+        return;
+    }
+    else if (strncmp("edit", line, 4) == 0 && configBuf[0] == 0)
+    {
+        const char* arg = line + 4;
+        while (*arg == ' ')
+            ++arg;
+
+        if (isdigit(*arg))
+            selectEditPreset(uint(atoi(arg)));
+        printf("next upload goes to preset %u; preset %u is live\n", getEditPreset(), activePreset);
+        return;
+    }
+    else if (strncmp("flash", line, 5) == 0 && configBuf[0] == 0)
+    {
+        dump_flash_store();
+        return;
+    }
+    else if (strncmp("stats", line, 5) == 0 && configBuf[0] == 0)
+    {
+        if (strstr(line, "reset"))
+        {
+            profile_reset();
+            puts("stats reset");
+        }
+        else
+        {
+            profile_dump();
+        }
+        return;
+    }
+    else if (strncmp("traffic", line, 7) == 0 && configBuf[0] == 0)
+    {
+        const MidiTxStats& tx = midi_get_tx_stats();
+        printf("controllers: %u sent, %u suppressed by hysteresis\n", uint(trafficStats.sent), uint(trafficStats.suppressed));
+        printf("midi tx: %u bytes sent, %u saved by running status, %u messages dropped\n", uint(tx.bytesSent), uint(tx.bytesSaved), uint(tx.messagesDropped));
+        printf("longest gap on the wire with bytes waiting: %u us\n", uint(tx.maxGapUs));
+        const MidiThruStats& thru = midi_get_thru_stats();
+        if (config->isThruEnabled() || thru.messages)
+        {
+            printf("midi thru: %u messages, %u sysex bytes, %u dropped; %u of ours held behind sysex; added latency mean %u max %u us\n",
+                uint(thru.messages), uint(thru.sysexBytes), uint(thru.dropped), uint(thru.held),
+                thru.messages ? uint(thru.totalAddedUs / thru.messages) : 0u, uint(thru.maxAddedUs));
+        }
+        const UsbMidiStats& usb = usb_midi_get_stats();
+        printf("usb midi (%s): %u packets sent, %u dropped, %u while unplugged; peak queue %u\n",
+            usb_midi_is_connected() ? "connected" : "not connected",
+            uint(usb.packetsSent), uint(usb.packetsDropped), uint(usb.packetsUnplugged), uint(usb.peakQueued));
+        return;
+    }
+    else if (strncmp("midiin", line, 6) == 0 && configBuf[0] == 0)
+    {
+        const MidiRxStats& rx = midi_get_rx_stats();
+        const MidiParserStats& parsed = midiIn.getStats();
+        printf("midi rx: %u bytes received, %u dropped, %u line errors; peak queue %u\n",
+            uint(rx.bytesReceived), uint(rx.bytesDropped), uint(rx.lineErrors), uint(rx.peakQueued));
+        printf("parsed: %u messages, %u realtime, %u sysex bytes; %u stray bytes, %u truncated\n",
+            uint(parsed.messages), uint(parsed.realtime), uint(parsed.sysexBytes), uint(parsed.strayBytes), uint(parsed.truncated));
+        extClock.dumpStats();
+        return;
+    }
+    else if (strncmp("clock", line, 5) == 0 && configBuf[0] == 0)
+    {
+        const char* arg = line + 5;
+        while (*arg == ' ')
+            ++arg;
+
+        if (!config->isClockOutEnabled())
+            puts("clock out is off; CLOCK on turns it on");
+        else if (strncmp("start", arg, 5) == 0)
+            midi_clock_start();
+        else if (strncmp("stop", arg, 4) == 0)
+            midi_clock_stop();
+        else if (strncmp("continue", arg, 8) == 0)
+            midi_clock_continue();
+        else if (strncmp("pos", arg, 3) == 0)
+        {
+            if (!midi_clock_set_song_position(uint16_t(atoi(arg + 3))))
+                puts("can only move the song position while stopped");
+        }
+        else if (strstr(arg, "reset"))
+        {
+            midi_reset_clock_stats();
+            puts("clock stats reset");
+        }
+        else
+        {
+            const MidiClockStats& clock = midi_get_clock_stats();
+            printf("clock out at %u bpm, %s at sixteenth %u\n", config->getBpm(),
+                midi_clock_is_running() ? "running" : "stopped", uint(midi_clock_get_song_position()));
+            if (clock.ticks < 2)
+            {
+                puts("no ticks yet");
+                return;
+            }
+            printf("%u ticks, interval min %u max %u us, jitter mean %u max %u us; latest %u us after due, %u missed\n",
+                uint(clock.ticks), uint(clock.minIntervalUs), uint(clock.maxIntervalUs),
+                uint(clock.totalJitterUs / (clock.ticks - 1)), uint(clock.maxJitterUs), uint(clock.maxLateUs), uint(clock.missed));
+        }
+        return;
+    }
+    else if (strncmp("rate", line, 4) == 0 && configBuf[0] == 0)
+    {
+        if (strstr(line, "reset"))
+        {
+            sampleClock.resetStats();
+#if MIDISISTER_DUAL_CORE
+            droppedSamplesAtReset = droppedSamples;
+#endif
+            puts("sample clock stats reset");
+        }
+        else
+        {
+            sampleClock.dumpStats();
+#if MIDISISTER_DUAL_CORE
+            printf("%u samples dropped by core1 (core0 fell behind)\n", uint(droppedSamples - droppedSamplesAtReset));
+#endif
+        }
+        return;
+    }
+
+    // each line's parsed into the shadow as it arrives, so the loop's only ever held up for one
+    // line's worth rather than for the whole config
+    uint32_t parseStartUs = time_us_32();
+    if (configBuf[0] == 0)
+    {
+        // the shadow's about to be overwritten, so anything still waiting in it has to go live first
+        applyPendingConfig();
+        parseStartUs = time_us_32();
+
+        shadowConfig->beginParse();
+        uploadOk = true;
+        uploadParseUs = 0;
+    }
 
     strcat(configBuf, line);
+    if (uploadOk)
+        uploadOk = shadowConfig->parseMore(line);
+
     if (!strstr(line, "END."))
     {
         strcat(configBuf, "\n");
+        uploadParseUs = std::max(uploadParseUs, time_us_32() - parseStartUs);
     }
     else
     {
-        if (config.parse(configBuf))
+        const uint preset = getEditPreset();
+        editPreset = -1;
+        if (uploadOk)
         {
-            save_flash_data((const uint8_t*)configBuf);
-            memset(configBuf, 0, sizeof(configBuf));
-            puts("updated config");
-            is_flash_save_valid();
-        }
-        else
-        {
-            const char* fallbackConfigBuf;
-            if (is_flash_save_valid())
+            shadowConfig->endParse();
+            puts("read config successfully");
+            if (save_flash_config(*shadowConfig, configBuf, preset))
             {
-                puts("reverting to saved");
-                fallbackConfigBuf = get_flash_save_data();
+                presetSaved[preset] = true;
             }
             else
             {
-                puts("reverting to default");
-                fallbackConfigBuf = defaultConfigStr;
+                // it still goes live, it just won't survive a reboot
+                puts("ERR: config not saved to flash; upload it again to keep it");
+                onError();
             }
-
-            config.parse(fallbackConfigBuf);
+            uploadParseUs = std::max(uploadParseUs, time_us_32() - parseStartUs);
+            pendingUpload = int(preset);
+        }
+        else
+        {
+            // the live config was never touched, so there's nothing to revert
+            puts("bad config; keeping the current one");
             // restore the error indicator
             onError();
         }
+        memset(configBuf, 0, sizeof(configBuf));
     }
 }
 
 StdinAsync stdinAsync(onLineRead);
 
 
-void loop(Nunchuk& nchk)
+// with the sample clock running, a read only starts on each tick; otherwise the nunchuk free runs
+bool pollNunchuk(Nunchuk& nchk)
 {
-    stdinAsync.update();
+    const bool clocked = sampleClock.isRunning();
+    nchk.setFreeRunning(!clocked);
+    if (clocked && sampleClock.takeTick() && !nchk.requestSample())
+        sampleClock.onSampleOverrun();
+
+    return nchk.update();
+}
+
+
+#if MIDISISTER_DUAL_CORE
+// core1 owns the nunchuk (including its calibration) and streams samples to core0, which does
+// everything else. core0 never touches i2c and core1 never touches the config or midi
+RingBuffer<Nunchuk::State, 16> sampleQueue;
+
+// calibration is only re-read on (re)init, and core0 needs it to build the mapping luts
+struct CalibrationUpdate
+{
+    Nunchuk::Calibration cal;
+    uint32_t id;
+};
+RingBuffer<CalibrationUpdate, 2> calibrationQueue;
+
+// set once core1 can be parked; flash writes before that (eg. the boot mount) leave it alone
+volatile bool core1Lockable = false;
 
-    uint32_t nowMs = millis();
-    uint32_t deltaMs = nowMs - lastMs;
-    if (!deltaMs)
+void core1Main()
+{
+    // lets core0 park us while it writes to flash
+    multicore_lockout_victim_init();
+    core1Lockable = true;
+
+    Nunchuk nchk(I2C_Block);
+    uint32_t sentCalibrationId = 0;
+    for(;;)
     {
-        sleep_ms(1);
+        if (!pollNunchuk(nchk))
+            continue;
+
+        // always ahead of the first sample that uses it
+        const uint32_t calibrationId = nchk.getCalibrationId();
+        if (calibrationId != sentCalibrationId && calibrationQueue.push({ nchk.getCalibration(), calibrationId }))
+            sentCalibrationId = calibrationId;
+
+        if (!sampleQueue.push(nchk.getState()))
+            droppedSamples = droppedSamples + 1;
+    }
+}
+#endif
+
+
+// returns false if there's no new sample to work on yet
+bool acquireSample(Nunchuk& nchk)
+{
+    PROFILE_STAGE(Nunchuk);
+
+#if MIDISISTER_DUAL_CORE
+    Nunchuk::State sample;
+    if (!sampleQueue.pop(sample))
+        return false;
+
+    CalibrationUpdate calUpdate;
+    while (sample.calibrationId != nchk.getCalibrationId() && calibrationQueue.pop(calUpdate))
+        nchk.applyCalibration(calUpdate.cal, calUpdate.id);
+
+    nchk.applySample(sample);
+    return true;
+#else
+    return pollNunchuk(nchk);
+#endif
+}
+
+// a synced repeat, once it's queued, goes out from a timer (see queueSyncedRepeat)
+uint32_t syncedRepeatTick = ~0u;    // the last tick a repeat was queued for
+uint32_t syncedRepeatDueUs = 0;
+byte syncedRepeatPrevNote = 0;      // what the queued repeat turns off
+
+// a repeat that's queued but not gone yet would leave a note hanging, whether it goes or not
+void cancelSyncedRepeat()
+{
+    if (int32_t(syncedRepeatDueUs - time_us_32()) <= 0)
         return;
+
+    midiScheduler.cancelTimed();
+    if (syncedRepeatPrevNote)
+        midiScheduler.noteOff(config->getChannel(), syncedRepeatPrevNote);
+    syncedRepeatDueUs = time_us_32();
+}
+
+// lets go of the held note (or arpeggio), and anything queued for it, on the current channel
+void releaseNotes()
+{
+    arp.stop(midiScheduler, time_us_32());
+    cancelSyncedRepeat();
+    if (playingNote)
+    {
+        midiScheduler.noteOff(config->getChannel(), playingNote);
+        playingNote = 0;
     }
-    lastMs = nowMs;
+}
+
+// happens at a frame boundary so nothing's ever half on one preset & half on the other
+void applyPendingPreset()
+{
+    if (pendingPreset < 0)
+        return;
+
+    const uint preset = uint(pendingPreset);
+    pendingPreset = -1;
+    if (preset == activePreset)
+        return;
+
+    // the old preset's channel might not be the new one's, so let go of everything first
+    releaseNotes();
 
-    nchk.update();
-        
-    if (config.areNotesEnabled())
+    resyncOutputs(*config, *presets[preset]);
+    activePreset = preset;
+    config = presets[preset];
+    onConfigChanged();
+    printf("switched to preset %u\n", preset);
+}
+
+// also at a frame boundary; the parse & save already happened with the old config still running,
+// so all that's left is swapping the pointers
+void applyPendingConfig()
+{
+    if (pendingUpload < 0)
+        return;
+
+    const uint32_t swapStartUs = time_us_32();
+    const uint preset = uint(pendingUpload);
+    pendingUpload = -1;
+
+    Config* replaced = presets[preset];
+    presets[preset] = shadowConfig;
+    shadowConfig = replaced;
+
+    if (preset == activePreset)
     {
-        uint16_t note = config.getMappedNote(nchk);
+        releaseNotes();
+        resyncOutputs(*config, *presets[preset]);
+        config = presets[preset];
+        onConfigChanged();
+    }
+    const uint32_t swapUs = time_us_32() - swapStartUs;
 
-        bool autoRepeat = false;
-        if (nchk.getBtnC() && nchk.getBtnZ())
-        {
-            int timeSinceLastNoteMs = nowMs - lastNoteMs;
-            if (timeSinceLastNoteMs >= config.getAutoRepeatMs() && note != playingNote)
-                autoRepeat = true;
-        }
+    printf("updated config for preset %u; longest stall while parsing & queueing for flash %u us, swapped in %u us\n", preset, uint(uploadParseUs), uint(swapUs));
+}
 
-        if (nchk.wasZPressed() || autoRepeat)
-        {
-            if (playingNote)
-                midi_note_off(config.getChannel(), playingNote);
+// double tapping C (with Z up) steps on to the next saved preset
+constexpr uint32_t PresetTapWindowUs = 400 * 1000;
+uint32_t lastPresetTapUs = 0;
+bool presetTapArmed = false;
 
-            midi_note_on(config.getChannel(), note);
-            playingNote = note;
-            lastNoteMs = nowMs;
+void checkPresetChord(const Nunchuk& nchk, uint32_t nowUs)
+{
+    if (!nchk.wasCPressed() || nchk.getBtnZ())
+        return;
 
-            ledState = 1 - ledState;
-            gpio_put(LedPin, ledState);
-        }
+    if (!presetTapArmed || (nowUs - lastPresetTapUs) > PresetTapWindowUs)
+    {
+        presetTapArmed = true;
+        lastPresetTapUs = nowUs;
+        return;
+    }
 
-        if (nchk.wasZReleased() && playingNote)
+    presetTapArmed = false;
+    for (uint i=1; i<=NumPresets; ++i)
+    {
+        const uint preset = (activePreset + i) % NumPresets;
+        if (presetSaved[preset] || preset == 0)
         {
-            midi_note_off(config.getChannel(), playingNote);            
-            playingNote = 0;
+            selectPreset(preset);
+            return;
         }
     }
+}
 
-    for (uint i=0; i<config.getNumMappings(); ++i)
+// with SYNC ext, a repeat lands on the clock tick it's due on: once that tick's predicted time is
+// close enough that no frame can fall in between, the notes are queued for it and go out from a
+// timer. without a running clock to follow, repeats fall back to BPM
+constexpr uint32_t MinScheduleLeadUs = 4 * 1000;
+
+bool isSyncedToClock()
+{
+    return config->getSync() == Sync::External && extClock.isLocked() && extClock.isRunning();
+}
+
+// how far ahead something has to be queued for the loop not to miss it; at least two frames
+uint32_t getScheduleLeadUs()
+{
+    const uint rateHz = sampleClock.getRate();
+    return std::max(MinScheduleLeadUs, rateHz ? 2 * 1000 * 1000 / rateHz : 0u);
+}
+
+void queueSyncedRepeat(byte note)
+{
+    const uint ticksPerRepeat = config->getAutoRepeatTicks();
+    const uint32_t ticks = extClock.getTicks();
+    const uint32_t tick = ticks + (ticksPerRepeat - ticks % ticksPerRepeat) % ticksPerRepeat;
+    if (tick == syncedRepeatTick)
+        return;
+
+    const uint32_t dueUs = extClock.getTickTimeUs(tick);
+    if (int32_t(dueUs - time_us_32()) > int32_t(getScheduleLeadUs()))
+        return;
+
+    if (playingNote)
+        midiScheduler.noteOffAt(dueUs, config->getChannel(), playingNote);
+    midiScheduler.noteOnAt(dueUs, config->getChannel(), note);
+
+    syncedRepeatTick = tick;
+    syncedRepeatDueUs = dueUs;
+    syncedRepeatPrevNote = playingNote;
+    playingNote = note;
+    lastNoteUs = dueUs;
+
+    ledState = 1 - ledState;
+    gpio_put(LedPin, ledState);
+}
+
+// with ARP on, Z runs the arpeggiator instead of playing a note
+void updateArp(const Nunchuk& nchk)
+{
+    const uint32_t nowUs = time_us_32();
+    if (nchk.wasZPressed())
+        arp.start(nowUs);
+    else if (nchk.wasZReleased())
+        arp.stop(midiScheduler, nowUs);
+
+    if (!arp.isPlaying())
+        return;
+
+    const uint baseIx = config->getNoteIndex(mappingLuts.getMappedNote(nchk));
+    const ExtClock* clock = isSyncedToClock() ? &extClock : nullptr;
+    if (arp.update(midiScheduler, *config, clock, baseIx, nchk.getJoyX(), nowUs, getScheduleLeadUs()))
+    {
+        ledState = 1 - ledState;
+        gpio_put(LedPin, ledState);
+    }
+}
+
+void updateNotes(const Nunchuk& nchk, uint32_t nowUs)
+{
+    PROFILE_STAGE(Notes);
+
+    if (config->getArpMode() != ArpMode::Off)
+    {
+        updateArp(nchk);
+        return;
+    }
+
+    uint16_t note = mappingLuts.getMappedNote(nchk);
+
+    bool autoRepeat = false;
+    if (nchk.getBtnC() && nchk.getBtnZ() && note != playingNote)
     {
-        const Mapping& mapping = config.getMappings()[i];
-        uint16_t val = mapping.getVal(nchk);
+        if (isSyncedToClock())
+            queueSyncedRepeat(byte(note));
+        else if (nowUs - lastNoteUs >= config->getAutoRepeatMs() * 1000)
+            autoRepeat = true;
+    }
+
+    if (nchk.wasZPressed() || autoRepeat)
+    {
+        if (playingNote)
+            midiScheduler.noteOff(config->getChannel(), playingNote);
+
+        midiScheduler.noteOn(config->getChannel(), note);
+        playingNote = note;
+        lastNoteUs = nowUs;
+
+        ledState = 1 - ledState;
+        gpio_put(LedPin, ledState);
+    }
+
+    if (nchk.wasZReleased() && playingNote)
+        releaseNotes();
+}
+
+void updateMappings(const Nunchuk& nchk)
+{
+    PROFILE_STAGE(Mappings);
+
+    const Config::Runtime& mappings = config->getRuntime();
+    for (uint i=0; i<config->getNumMappings(); ++i)
+    {
+        // the notes mapping is played by updateNotes; nothing goes out for it here
+        if (mappings.destType[i] == Dest::Note)
+            continue;
+
+        uint16_t raw = mappingFilters[i].apply(nchk.getRawAxis(mappingLuts.getAxis(i)), mappings.emaAlpha[i]);
+        uint16_t val = mappingLuts.lookup(i, raw);
         if (val == lastOutputVals[i])
             continue;
 
-        if (mapping.destType == Dest::ControlChange)
-            midi_cc(config.getChannel(), byte(mapping.destParam), byte(val));
-        else if (mapping.destType == Dest::PitchBend)
-            midi_pitchbend(config.getChannel(), val);
+        const uint16_t change = uint16_t(std::abs(int(val) - int(lastOutputVals[i])));
+        if (change < mappings.hysteresis[i] && val != mappings.toLo[i] && val != mappings.toHi[i])
+        {
+            ++trafficStats.suppressed;
+            continue;
+        }
+
+        if (mappings.destType[i] == Dest::ControlChange)
+            midiScheduler.controlChange(config->getChannel(), byte(mappings.destParam[i]), byte(val), mappings.minIntervalUs[i]);
+        else if (mappings.destType[i] == Dest::PitchBend)
+            midiScheduler.pitchBend(config->getChannel(), val, mappings.minIntervalUs[i]);
+        else if (mappings.destType[i] == Dest::ControlChange14)
+            midiScheduler.controlChange14(config->getChannel(), byte(mappings.destParam[i]), val, mappings.minIntervalUs[i]);
+        else if (mappings.destType[i] == Dest::Nrpn)
+            midiScheduler.nrpn(config->getChannel(), mappings.destParam[i], val, mappings.minIntervalUs[i]);
 
+        ++trafficStats.sent;
         lastOutputVals[i] = val;
     }
 }
 
-int main() {
+// a save only gets one flash step at a time, and the loop always gets a look in between them.
+// the step itself still holds the loop up: ~0.4ms for a page, but ~45ms for a sector erase, so a
+// collect costs a missed frame or so per sector; only the live irqs (see setup) keep going
+constexpr uint32_t FlashStepGapUs = 4 * 1000;
+uint32_t lastFlashStepUs = 0;
+
+void updateFlashSave()
+{
+    if (time_us_32() - lastFlashStepUs < FlashStepGapUs)
+        return;
+
+    if (update_flash_save())
+        lastFlashStepUs = time_us_32();
+}
+
+void loop(Nunchuk& nchk)
+{
+    stdinAsync.update();
+    updateMidiIn();
+
+    applyPendingConfig();
+    applyPendingPreset();
+
+    midiScheduler.update();
+    midi_update();
+    usb_midi_update();
+    updateFlashSave();
+
+    // nothing else to do until the nunchuk has a fresh sample for us
+    if (!acquireSample(nchk))
+        return;
+
+    PROFILE_COUNT(Frames);
+    const uint32_t frameStartUs = time_us_32();
+
+    // timing comes from the sample itself, so auto repeat stays on the sample clock's grid
+    const uint32_t sampleUs = nchk.getState().timeUs;
+
+    checkPresetChord(nchk, sampleUs);
+
+    if (mappingLuts.isStale(nchk))
+        mappingLuts.build(*config, nchk);
+
+    if (config->areNotesEnabled())
+        updateNotes(nchk, sampleUs);
+
+    updateMappings(nchk);
+
+    midiScheduler.update();
+    midi_update();
+    usb_midi_update();
+
+    sampleClock.onFrame(sampleUs, time_us_32() - frameStartUs);
+}
+
+void setup()
+{
     gpio_init(LedPin);
     gpio_set_dir(LedPin, GPIO_OUT);
     gpio_put(LedPin, 1);
 
+    usb_midi_init();
     stdio_usb_init();
 
     midi_init(uart0, UART_TX_Gpio, UART_RX_Gpio);
+    set_flash_live_irqs((1u << midi_get_irq()) | (1u << midi_get_clock_irq()));
     
-    const char* configStr = is_flash_save_valid() ? get_flash_save_data() : defaultConfigStr;
-    config.parse(configStr);
+    for (uint i=0; i<NumPresets; ++i)
+        loadPreset(i);
+    // boot goes the same way as any later change
+    onConfigChanged();
 
     i2c_init(I2C_Block, I2C_Baud);
     gpio_set_function(I2C_SDA_Gpio, GPIO_FUNC_I2C);
@@ -222,13 +854,27 @@ int main() {
     // cancel any previous notes
     sleep_ms(1);
     for (byte note=1; note<120; ++note)
-        midi_note_off(config.getChannel(), note);
+        midi_note_off(config->getChannel(), note);
+    midi_flush();
 
     initError();
+}
 
+// the host simulation (see sim/) provides its own main and drives setup() and loop() itself
+#if !MIDISISTER_SIM
+int main() {
+    setup();
+
+#if MIDISISTER_DUAL_CORE
+    multicore_launch_core1(core1Main);
+    while (!core1Lockable)
+        tight_loop_contents();
+    set_flash_core1_running(true);
+    // only ever fed by applySample
+    Nunchuk nchk(nullptr);
+#else
     Nunchuk nchk(I2C_Block);
-    
-    lastMs = millis();
+#endif
 
     for(;;)
     {
@@ -237,3 +883,4 @@ int main() {
 
     return 0;
 }
+#endif
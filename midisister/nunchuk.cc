@@ -1,4 +1,5 @@
 #include "nunchuk.h"
+#include "profile.h"
 #include "util.h"
 
 #include <algorithm>
@@ -12,11 +13,13 @@ Nunchuk::Nunchuk(i2c_inst_t* i2cBlock)
 bool Nunchuk::init()
 {
     m_ready = false;
+    m_phase = Phase::Idle;
+    m_lastInitMs = millis();
 
     m_error = false;
     if (initNoEncryption() &&
         getIdent() &&
-        getCalibration())
+        readCalibration())
     {
         m_ready = true;
         return true;
@@ -29,35 +32,189 @@ void Nunchuk::onError()
 {
     m_ready = false;
     m_error = true;
+    m_phase = Phase::Idle;
+    flushController();
 
+    PROFILE_COUNT(I2cErrors);
     ::onError();
 }
 
-void Nunchuk::update()
+bool Nunchuk::update()
 {
+    m_newSample = false;
+    m_prevState = m_state;
+
     if (!m_ready)
     {
+        // init blocks for a few hundred ms, so don't hammer it while the nunchuk is unplugged
+        if (m_error && (millis() - m_lastInitMs) < InitRetryMs)
+            return false;
+
         if (!init())
-            return;
+            return false;
         clearError();
     }
 
-    m_prevState = m_state;
+    switch (m_phase)
+    {
+        case Phase::Idle:
+            if (m_freeRunning || m_sampleRequested)
+                startStateRead();
+            break;
+
+        case Phase::Converting:
+        case Phase::Reading:
+            if (pollStateRead())
+            {
+                // get the next conversion going straight away, unless we're being clocked
+                if (m_freeRunning)
+                    startStateRead();
+                m_newSample = true;
+            }
+            break;
+    }
+
+    //m_state.dump();
+    //printf("\r");
+
+    return m_newSample;
+}
+
+bool Nunchuk::requestSample()
+{
+    if (m_phase != Phase::Idle)
+        return false;
+
+    m_sampleRequested = true;
+    return true;
+}
+
+
+// the blocking i2c calls during init leave the controller targeting the nunchuk, so from here on
+// we drive the command fifo directly and poll for completion rather than waiting on it
+
+void Nunchuk::startStateRead()
+{
+    i2c_get_hw(m_i2cBlock)->data_cmd = StateAddr | I2C_IC_DATA_CMD_STOP_BITS;
+    m_sampleRequested = false;
+
+    m_phase = Phase::Converting;
+    m_phaseStartUs = time_us_32();
+}
+
+bool Nunchuk::checkAbort()
+{
+    i2c_hw_t* hw = i2c_get_hw(m_i2cBlock);
+    if ((hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) == 0)
+        return false;
+
+    // reading the clear register acks the abort
+    (void)hw->clr_tx_abrt;
+    onError();
+    puts("i2c transfer aborted");
+    return true;
+}
+
+// a failed or abandoned read can leave commands queued & bytes in the rx fifo, which the next
+// state read would pick up as its own. disabling the controller flushes both fifos
+void Nunchuk::flushController()
+{
+    i2c_hw_t* hw = i2c_get_hw(m_i2cBlock);
+    hw->enable = 0;
+
+    // it finishes the byte in flight (and sends a stop) before it lets go
+    const uint32_t startUs = time_us_32();
+    while ((hw->enable_status & I2C_IC_ENABLE_STATUS_IC_EN_BITS) && (time_us_32() - startUs) < DisableTimeoutUs)
+        tight_loop_contents();
+
+    (void)hw->clr_tx_abrt;
+    hw->enable = I2C_IC_ENABLE_ENABLE_BITS;
+}
+
+bool Nunchuk::pollStateRead()
+{
+    constexpr uint NumStateBytes = 6;
+
+    if (checkAbort())
+        return false;
+
+    i2c_hw_t* hw = i2c_get_hw(m_i2cBlock);
+    const uint32_t elapsedUs = time_us_32() - m_phaseStartUs;
+
+    if (m_phase == Phase::Converting)
+    {
+        if (elapsedUs < ConversionDelayUs)
+            return false;
+
+        for (uint i=0; i<NumStateBytes; ++i)
+            hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS | ((i == NumStateBytes-1) ? I2C_IC_DATA_CMD_STOP_BITS : 0);
+
+        m_phase = Phase::Reading;
+        m_phaseStartUs = time_us_32();
+        return false;
+    }
 
-    byte buf[6];
-    readBlocking(StateAddr, buf);
+    if (i2c_get_read_available(m_i2cBlock) < NumStateBytes)
+    {
+        if (elapsedUs > ReadTimeoutUs)
+        {
+            onError();
+            puts("timed out reading nunchuk state");
+        }
+        return false;
+    }
+
+    byte buf[NumStateBytes];
+    for (byte& b : buf)
+        b = byte(hw->data_cmd & I2C_IC_DATA_CMD_DAT_BITS);
 
     RawState raw;
     raw.setFromBuf(buf);
-
     m_state.set(raw, m_cal);
-    sleep_ms(3);
+    m_state.timeUs = time_us_32();
+    m_state.calibrationId = m_calibrationId;
 
-    //m_state.dump();
-    //printf("\r");
-    // printf("    <-- ");
-    // raw.dump();
-    //puts("\n");
+    m_phase = Phase::Idle;
+    return true;
+}
+
+void Nunchuk::applySample(const State& sample)
+{
+    m_prevState = m_state;
+    m_state = sample;
+    m_newSample = true;
+}
+
+void Nunchuk::applyCalibration(const Calibration& cal, uint32_t calibrationId)
+{
+    m_cal = cal;
+    m_calibrationId = calibrationId;
+}
+
+fixed Nunchuk::getAxis(Axis axis) const
+{
+    switch (axis)
+    {
+        case Axis::JoyX:    return m_state.joyX;
+        case Axis::JoyY:    return m_state.joyY;
+        case Axis::AccelX:  return m_state.accelX;
+        case Axis::AccelY:  return m_state.accelY;
+        case Axis::AccelZ:  return m_state.accelZ;
+    }
+    return 0;
+}
+
+uint16_t Nunchuk::getRawAxis(Axis axis) const
+{
+    switch (axis)
+    {
+        case Axis::JoyX:    return m_state.raw.joyX;
+        case Axis::JoyY:    return m_state.raw.joyY;
+        case Axis::AccelX:  return m_state.raw.accelX;
+        case Axis::AccelY:  return m_state.raw.accelY;
+        case Axis::AccelZ:  return m_state.raw.accelZ;
+    }
+    return 0;
 }
 
 
@@ -137,45 +294,70 @@ void Nunchuk::Calibration::dump() const
 
 void Nunchuk::Calibration::JoyAxis::precalc()
 {
+    constexpr uint32_t One = 1u << 23;
     int negRange = ctr - min;
-    recipNeg = 1.0f / float(negRange);
+    recipNeg = One / uint32_t(std::max(negRange, 1));
     int posRange = max - ctr;
-    recipPos = 1.0f / float(posRange);
+    recipPos = One / uint32_t(std::max(posRange, 1));
 }
 
-inline float Nunchuk::Calibration::JoyAxis::parseRaw(byte raw) const
+inline fixed Nunchuk::Calibration::JoyAxis::parseRaw(byte raw) const
 {
-    constexpr float deadzone = 0.1f;
+    constexpr fixed deadzone = fixed_from_float(0.1f);
+    // scales [deadzone, 1-deadzone] up to [0, 1]; ie. *1 / (1 - 2*deadzone)
+    auto removeDeadzone = [](fixed fullVal) { return std::clamp<fixed>(((fullVal - deadzone) * 5) >> 2, 0, FixedOne); };
+
+    // (<=255 * Q23) fits in 32 bits unsigned; >> 8 takes it to Q15
     if (raw < ctr)
     {
-        const float fullVal = (ctr - raw) * recipNeg;
-        const float val = (fullVal - deadzone) * (1.0f  / (1.0f - (2.f * deadzone)));
-        return -1.f * std::clamp(val, 0.f, 1.f);
+        const fixed fullVal = fixed((uint32_t(ctr - raw) * recipNeg) >> 8);
+        return -removeDeadzone(fullVal);
     }
     else
     {
-        const float fullVal = (raw - ctr) * recipPos;
-        const float val = (fullVal - deadzone) * (1.0f  / (1.0f - (2.f * deadzone)));
-        return std::clamp(val, 0.f, 1.f);
+        const fixed fullVal = fixed((uint32_t(raw - ctr) * recipPos) >> 8);
+        return removeDeadzone(fullVal);
     }
 }
 
 
 void Nunchuk::Calibration::AccelAxis::precalc()
 {
+    // keep |delta| away from 0 so that (<=1023 * Q23 recip) can't overflow
+    constexpr int32_t One = 1 << 23;
+    constexpr int MinDeltaG = 16;
     int deltaG = oneG - zeroG;
-    recipOneG = 1.0f / float(deltaG);
+    if (deltaG >= 0)
+        recipOneG = One / std::max(deltaG, MinDeltaG);
+    else
+        recipOneG = -(One / std::max(-deltaG, MinDeltaG));
+}
+
+inline fixed Nunchuk::Calibration::AccelAxis::parseRaw(uint16_t raw) const
+{
+    int32_t centred = raw - zeroG;
+    return (centred * recipOneG) >> 8;
 }
 
-inline float Nunchuk::Calibration::AccelAxis::parseRaw(uint16_t raw) const
+
+fixed Nunchuk::Calibration::calibrate(Axis axis, uint16_t raw) const
 {
-    int centred = raw - zeroG;
-    return float(centred) * recipOneG;
+    switch (axis)
+    {
+        case Axis::JoyX:    return joyX.parseRaw(byte(raw));
+        case Axis::JoyY:    return joyY.parseRaw(byte(raw));
+        case Axis::AccelX:  return accelX.parseRaw(raw);
+        case Axis::AccelY:  return accelY.parseRaw(raw);
+        case Axis::AccelZ:  return accelZ.parseRaw(raw);
+    }
+    return 0;
 }
 
 
 void Nunchuk::State::set(const RawState& raw, const Calibration& cal)
 {
+    this->raw = raw;
+
     accelX = cal.accelX.parseRaw(raw.accelX);
     accelY = cal.accelY.parseRaw(raw.accelY);
     accelZ = cal.accelZ.parseRaw(raw.accelZ);
@@ -190,8 +372,8 @@ void Nunchuk::State::set(const RawState& raw, const Calibration& cal)
 void Nunchuk::State::dump() const
 {
     printf("joy %.03f,%.03f  accel %.03f,%.03f,%.03f  %c %c",
-        joyX, joyY,
-        accelX, accelY, accelZ,
+        fixed_to_float(joyX), fixed_to_float(joyY),
+        fixed_to_float(accelX), fixed_to_float(accelY), fixed_to_float(accelZ),
         btnC?'C':'c', btnZ?'Z':'z');
 }
 
@@ -268,12 +450,13 @@ bool Nunchuk::getIdent()
     return !m_error;
 }
 
-bool Nunchuk::getCalibration()
+bool Nunchuk::readCalibration()
 {
     byte buf[16];
     readBlocking(CalibrationAddr, buf);
 
     m_cal.setFromBuf(buf);
+    ++m_calibrationId;
 
     // puts("calibration: ");
     // m_cal.dump();
@@ -14,16 +14,30 @@ class Nunchuk
     static constexpr byte CalibrationAddr = 0x20;
     static constexpr byte IdentAddr = 0xFA;
 
+    // how long the nunchuk needs between being told which register to read and the read itself
+    static constexpr uint32_t ConversionDelayUs = 1000;
+    static constexpr uint32_t ReadTimeoutUs = 5000;
+    static constexpr uint32_t DisableTimeoutUs = 1000;
+    static constexpr uint32_t InitRetryMs = 500;
+
 public:
     Nunchuk(i2c_inst_t* i2cBlock);
 
-    void update();
-
-    float getJoyX() const       { return m_state.joyX; }
-    float getJoyY() const       { return m_state.joyY; }
-    float getAccelX() const     { return m_state.accelX; }
-    float getAccelY() const     { return m_state.accelY; }
-    float getAccelZ() const     { return m_state.accelZ; }
+    // steps the acquisition state machine without blocking (other than for (re)initialisation)
+    // returns true when a new sample has arrived; the getters & button edges refer to that sample
+    bool update();
+    bool hasNewSample() const   { return m_newSample; }
+
+    // free running (the default) starts the next read as soon as the last one lands; otherwise a
+    // read only starts after requestSample(), which fails if the previous one is still in flight
+    void setFreeRunning(bool freeRunning)   { m_freeRunning = freeRunning; }
+    bool requestSample();
+
+    fixed getJoyX() const       { return m_state.joyX; }
+    fixed getJoyY() const       { return m_state.joyY; }
+    fixed getAccelX() const     { return m_state.accelX; }
+    fixed getAccelY() const     { return m_state.accelY; }
+    fixed getAccelZ() const     { return m_state.accelZ; }
     bool  getBtnC() const       { return m_state.btnC; }
     bool  getBtnZ() const       { return m_state.btnZ; }
 
@@ -40,31 +54,43 @@ private:
     bool readBlocking(byte addr, Buf& buf);
 
     bool init();
+    void startStateRead();
+    bool pollStateRead();
+    bool checkAbort();
+    void flushController();
+
     bool initNoEncryption();
     bool getIdent();
-    bool getCalibration();
+    bool readCalibration();
 
     void onError();
 
-private:
+public:
+    enum class Axis : uint8_t
+    {
+        JoyX, JoyY,             // 8 bit raw
+        AccelX, AccelY, AccelZ, // 10 bit raw
+    };
+    static constexpr uint getRawRange(Axis axis)    { return (axis <= Axis::JoyY) ? 256 : 1024; }
+
     struct Calibration
     {
         struct JoyAxis
         {
             uint8_t  min, ctr, max;
-            float recipNeg, recipPos;
+            uint32_t recipNeg, recipPos;    // Q23
 
             void precalc();
-            inline float parseRaw(byte raw) const;
+            inline fixed parseRaw(byte raw) const;
         };
 
         struct AccelAxis
         {
             uint16_t zeroG, oneG;
-            float recipOneG;
+            int32_t recipOneG;              // Q23
 
             void precalc();
-            inline float parseRaw(uint16_t raw) const;
+            inline fixed parseRaw(uint16_t raw) const;
         };
 
         AccelAxis accelX, accelY, accelZ;
@@ -72,6 +98,8 @@ private:
         
         void setFromBuf(const byte* buf);
         void dump() const;
+
+        fixed calibrate(Axis axis, uint16_t raw) const;
     };
 
     struct RawState
@@ -86,20 +114,52 @@ private:
 
     struct State
     {
-        float joyX, joyY;
-        float accelX, accelY, accelZ;
+        fixed joyX, joyY;
+        fixed accelX, accelY, accelZ;
         bool  btnC=false, btnZ=false;
+        uint32_t timeUs = 0;    // when the sample was read
+        RawState raw = {};
+        uint32_t calibrationId = 0;
 
         void set(const RawState& raw, const Calibration& cal);
         void dump() const;
     };
 
+    const State& getState() const   { return m_state; }
+
+    fixed getAxis(Axis axis) const;
+    uint16_t getRawAxis(Axis axis) const;
+
+    // changes whenever the calibration is re-read, ie. after every (re)init
+    uint32_t getCalibrationId() const           { return m_calibrationId; }
+    const Calibration& getCalibration() const   { return m_cal; }
+
+    // for a nunchuk that's polled elsewhere (i.e. on the other core); feeds in the next sample
+    // as though update() had just read it
+    void applySample(const State& sample);
+    void applyCalibration(const Calibration& cal, uint32_t calibrationId);
+
+private:
+    enum class Phase : uint8_t
+    {
+        Idle,           // nothing in flight
+        Converting,     // register address written, waiting for the nunchuk to latch its state
+        Reading,        // read commands queued, waiting for the 6 bytes to arrive
+    };
+
     i2c_inst_t* m_i2cBlock;
 
     bool        m_ready = false;
     bool        m_error = false;
+    bool        m_newSample = false;
+    bool        m_freeRunning = true;
+    bool        m_sampleRequested = false;
+    Phase       m_phase = Phase::Idle;
+    uint32_t    m_phaseStartUs = 0;
+    uint32_t    m_lastInitMs = 0;
 
     Calibration m_cal;
+    uint32_t    m_calibrationId = 0;
     State       m_state;
     State       m_prevState;
 };
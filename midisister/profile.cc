@@ -0,0 +1,97 @@
+#include "profile.h"
+#include "midi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+
+#if MIDISISTER_PROFILE
+
+namespace {
+
+// bucket n holds times in [2^(n-1), 2^n) us; bucket 0 is under 1us and the last catches everything over ~16ms
+constexpr uint NumBuckets = 16;
+
+struct StageStats
+{
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+    uint32_t buckets[NumBuckets];
+};
+
+StageStats Stages[uint(ProfileStage::Count)];
+uint32_t Counters[uint(ProfileCounter::Count)];
+
+const char* const StageNames[] = { "stdin", "nunchuk", "notes", "mappings", "midi", "midi in" };
+static_assert(std::size(StageNames) == uint(ProfileStage::Count));
+
+uint bucket_for(uint32_t us)
+{
+    uint bucket = 0;
+    while (us && bucket < NumBuckets - 1)
+    {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+};
+
+
+void profile_record(ProfileStage stage, uint32_t us)
+{
+    StageStats& stats = Stages[uint(stage)];
+    if (!stats.count || us < stats.minUs)
+        stats.minUs = us;
+    stats.maxUs = std::max(stats.maxUs, us);
+    stats.totalUs += us;
+    ++stats.count;
+    ++stats.buckets[bucket_for(us)];
+}
+
+void profile_count(ProfileCounter counter)
+{
+    ++Counters[uint(counter)];
+}
+
+void profile_dump()
+{
+    puts("stage      count      min    mean     max   (us)   log2 histogram from <1us");
+    for (uint i=0; i<uint(ProfileStage::Count); ++i)
+    {
+        const StageStats& stats = Stages[i];
+        const uint32_t meanUs = stats.count ? uint32_t(stats.totalUs / stats.count) : 0;
+        printf("%-9s %7u  %7u %7u %7u        ", StageNames[i], uint(stats.count), uint(stats.minUs), uint(meanUs), uint(stats.maxUs));
+        for (uint32_t bucketCount : stats.buckets)
+            printf(" %u", uint(bucketCount));
+        puts("");
+    }
+
+    const MidiTxStats& tx = midi_get_tx_stats();
+    printf("frames %u, i2c errors %u, midi bytes sent %u\n",
+        uint(Counters[uint(ProfileCounter::Frames)]), uint(Counters[uint(ProfileCounter::I2cErrors)]), uint(tx.bytesSent));
+}
+
+void profile_reset()
+{
+    std::fill(std::begin(Stages), std::end(Stages), StageStats{});
+    std::fill(std::begin(Counters), std::end(Counters), 0);
+    midi_reset_tx_stats();
+}
+
+#else
+
+void profile_dump()
+{
+    puts("profiling is compiled out; build with MIDISISTER_PROFILE=ON");
+}
+
+void profile_reset()
+{
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "util.h"
+
+
+// hot loop instrumentation; build with MIDISISTER_PROFILE to enable it, otherwise it all compiles away
+enum class ProfileStage : uint8_t
+{
+    Stdin,
+    Nunchuk,
+    Notes,
+    Mappings,
+    Midi,
+    MidiIn,
+
+    Count
+};
+
+enum class ProfileCounter : uint8_t
+{
+    Frames,         // loops that had a new nunchuk sample to work on
+    I2cErrors,
+
+    Count
+};
+
+
+#if MIDISISTER_PROFILE
+
+void profile_record(ProfileStage stage, uint32_t us);
+void profile_count(ProfileCounter counter);
+
+class ProfileScope
+{
+public:
+    ProfileScope(ProfileStage stage) : m_stage(stage), m_startUs(time_us_32()) { /**/ }
+    ~ProfileScope()     { profile_record(m_stage, time_us_32() - m_startUs); }
+
+private:
+    ProfileStage m_stage;
+    uint32_t m_startUs;
+};
+
+#define PROFILE_CONCAT_(a, b)   a##b
+#define PROFILE_CONCAT(a, b)    PROFILE_CONCAT_(a, b)
+
+// times the rest of the enclosing scope
+#define PROFILE_STAGE(stage)    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(ProfileStage::stage)
+#define PROFILE_COUNT(counter)  profile_count(ProfileCounter::counter)
+
+#else
+
+#define PROFILE_STAGE(stage)    do {} while (false)
+#define PROFILE_COUNT(counter)  do {} while (false)
+
+#endif
+
+
+// print everything / start again; these are there either way so the console command always works
+void profile_dump();
+void profile_reset();
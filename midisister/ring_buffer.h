@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "pico/stdlib.h"
+
+
+// lock-free single-producer / single-consumer ring buffer
+// safe between an irq handler and the main loop, or between the two cores, as long as
+// only one side ever pushes and only one side ever pops
+// everything's forced inline, so it runs from wherever the caller does; the irq handlers that
+// keep going while flash is busy are in ram, and must never call out to flash
+template<typename T, uint32_t Capacity>
+class RingBuffer
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+    static constexpr uint32_t Mask = Capacity - 1;
+
+public:
+    static constexpr uint32_t capacity()    { return Capacity; }
+
+    __force_inline uint32_t size() const   { return m_writePos.load(std::memory_order_acquire) - m_readPos.load(std::memory_order_acquire); }
+    __force_inline uint32_t space() const  { return Capacity - size(); }
+    __force_inline bool empty() const      { return size() == 0; }
+    __force_inline bool full() const       { return size() == Capacity; }
+
+    // producer side
+    __force_inline bool push(const T& val)
+    {
+        const uint32_t writePos = m_writePos.load(std::memory_order_relaxed);
+        if (writePos - m_readPos.load(std::memory_order_acquire) >= Capacity)
+            return false;
+
+        m_items[writePos & Mask] = val;
+        m_writePos.store(writePos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // all or nothing; either every item is queued or none are
+    __force_inline bool push(const T* vals, uint32_t count)
+    {
+        const uint32_t writePos = m_writePos.load(std::memory_order_relaxed);
+        if (Capacity - (writePos - m_readPos.load(std::memory_order_acquire)) < count)
+            return false;
+
+        for (uint32_t i=0; i<count; ++i)
+            m_items[(writePos + i) & Mask] = vals[i];
+        m_writePos.store(writePos + count, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    __force_inline bool pop(T& out)
+    {
+        const uint32_t readPos = m_readPos.load(std::memory_order_relaxed);
+        if (m_writePos.load(std::memory_order_acquire) == readPos)
+            return false;
+
+        out = m_items[readPos & Mask];
+        m_readPos.store(readPos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // NB. only valid when !empty()
+    __force_inline const T& peek() const   { return m_items[m_readPos.load(std::memory_order_relaxed) & Mask]; }
+
+    // the run of queued items from the front that's contiguous in memory, so they can be read in
+    // place & then drop()ped; if the queue wraps, the rest comes from the next call
+    __force_inline uint32_t peekContiguous(const T*& out) const
+    {
+        const uint32_t readPos = m_readPos.load(std::memory_order_relaxed);
+        const uint32_t count = m_writePos.load(std::memory_order_acquire) - readPos;
+        const uint32_t start = readPos & Mask;
+        out = &m_items[start];
+        return (count < Capacity - start) ? count : Capacity - start;
+    }
+
+    __force_inline void drop(uint32_t count = 1)
+    {
+        m_readPos.store(m_readPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // consumer side; throws away everything currently queued
+    __force_inline void clear()
+    {
+        m_readPos.store(m_writePos.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T m_items[Capacity];
+    std::atomic<uint32_t> m_writePos{0};
+    std::atomic<uint32_t> m_readPos{0};
+};
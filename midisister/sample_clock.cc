@@ -0,0 +1,106 @@
+#include "sample_clock.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+
+void SampleClock::setRate(uint rateHz)
+{
+    rateHz = std::min(rateHz, MaxRateHz);
+    if (rateHz == getRate())
+        return;
+
+    if (m_timerActive)
+    {
+        cancel_repeating_timer(&m_timer);
+        m_timerActive = false;
+    }
+
+    m_rateHz.store(rateHz, std::memory_order_relaxed);
+    m_periodUs = rateHz ? (1000 * 1000) / rateHz : 0;
+    resetStats();
+
+    // a negative delay is measured from the previous tick's due time rather than from when its
+    // callback ran, so irq latency doesn't accumulate into drift
+    if (rateHz)
+        m_timerActive = add_repeating_timer_us(-int64_t(m_periodUs), onAlarm, this, &m_timer);
+}
+
+bool __not_in_flash_func(SampleClock::onAlarm)(repeating_timer_t* timer)
+{
+    SampleClock* clock = static_cast<SampleClock*>(timer->user_data);
+    clock->m_ticks.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+bool SampleClock::takeTick()
+{
+    const uint32_t ticks = m_ticks.load(std::memory_order_acquire);
+    const uint32_t pending = ticks - m_takenTicks;
+    if (!pending)
+        return false;
+
+    m_sampleOverruns += pending - 1;
+    m_takenTicks = ticks;
+    return true;
+}
+
+void SampleClock::onFrame(uint32_t sampleUs, uint32_t frameUs)
+{
+    if (m_frames)
+    {
+        const uint32_t intervalUs = sampleUs - m_lastSampleUs;
+        if (m_frames == 1 || intervalUs < m_minIntervalUs)
+            m_minIntervalUs = intervalUs;
+        m_maxIntervalUs = std::max(m_maxIntervalUs, intervalUs);
+        if (m_periodUs)
+            m_totalJitterUs += uint32_t(std::abs(int32_t(intervalUs - m_periodUs)));
+    }
+    m_lastSampleUs = sampleUs;
+    ++m_frames;
+
+    m_maxFrameUs = std::max(m_maxFrameUs, frameUs);
+    if (m_periodUs && frameUs > m_periodUs)
+        ++m_frameOverruns;
+}
+
+void SampleClock::dumpStats() const
+{
+    const uint rateHz = getRate();
+    if (rateHz)
+        printf("sample clock %uHz (%uus period)\n", rateHz, uint(m_periodUs));
+    else
+        puts("sample clock off; nunchuk is free running");
+
+    if (m_frames < 2)
+    {
+        puts("no frames yet");
+        return;
+    }
+
+    const uint32_t intervals = m_frames - 1;
+    printf("%u frames, interval min %u max %u us", uint(m_frames), uint(m_minIntervalUs), uint(m_maxIntervalUs));
+    if (m_periodUs)
+    {
+        const uint32_t lateUs = (m_maxIntervalUs > m_periodUs) ? m_maxIntervalUs - m_periodUs : 0;
+        const uint32_t earlyUs = (m_minIntervalUs < m_periodUs) ? m_periodUs - m_minIntervalUs : 0;
+        const uint32_t maxJitterUs = std::max(lateUs, earlyUs);
+        printf(", jitter mean %u max %u us", uint(m_totalJitterUs / intervals), uint(maxJitterUs));
+    }
+    puts("");
+
+    printf("longest frame %u us; overruns: %u samples, %u frames\n", uint(m_maxFrameUs), uint(m_sampleOverruns), uint(m_frameOverruns));
+}
+
+void SampleClock::resetStats()
+{
+    m_sampleOverruns = 0;
+    m_frameOverruns = 0;
+    m_frames = 0;
+    m_lastSampleUs = 0;
+    m_minIntervalUs = 0;
+    m_maxIntervalUs = 0;
+    m_totalJitterUs = 0;
+    m_maxFrameUs = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "pico/stdlib.h"
+#include "util.h"
+
+
+// fixed rate frame clock, driven by a repeating hardware alarm
+// the alarm irq only counts ticks; whoever polls the nunchuk takes them and starts one read per
+// tick, so samples land on an even grid no matter how busy the rest of the loop is
+class SampleClock
+{
+public:
+    // a state read takes ~1.7ms on the wire, so much past 500Hz is all overruns
+    static constexpr uint MaxRateHz = 1000;
+
+    // 0 stops the clock, which leaves the nunchuk free running
+    void setRate(uint rateHz);
+    uint getRate() const        { return m_rateHz.load(std::memory_order_relaxed); }
+    bool isRunning() const      { return getRate() != 0; }
+
+    // polling side; true if a tick has arrived since the last call
+    // any more than one means samples were skipped, which counts as an overrun
+    bool takeTick();
+    // a tick arrived while the previous read was still in flight
+    void onSampleOverrun()      { ++m_sampleOverruns; }
+
+    // frame side; the time the sample was read, and how long processing it took
+    void onFrame(uint32_t sampleUs, uint32_t frameUs);
+
+    void dumpStats() const;
+    void resetStats();
+
+private:
+    static bool onAlarm(repeating_timer_t* timer);
+
+    repeating_timer_t m_timer = {};
+    bool m_timerActive = false;
+    std::atomic<uint> m_rateHz{0};
+    uint32_t m_periodUs = 0;
+
+    std::atomic<uint32_t> m_ticks{0};
+    uint32_t m_takenTicks = 0;
+
+    // written by the polling side
+    uint32_t m_sampleOverruns = 0;
+
+    // written by the frame side
+    uint32_t m_frameOverruns = 0;
+    uint32_t m_frames = 0;
+    uint32_t m_lastSampleUs = 0;
+    uint32_t m_minIntervalUs = 0;
+    uint32_t m_maxIntervalUs = 0;
+    uint64_t m_totalJitterUs = 0;
+    uint32_t m_maxFrameUs = 0;
+};
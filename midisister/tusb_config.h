@@ -0,0 +1,28 @@
+#pragma once
+
+// tinyusb setup for the composite device in usb_descriptors.cc; stdio_usb picks this up too
+// CFG_TUSB_MCU comes from the sdk's build
+
+#ifndef CFG_TUSB_RHPORT0_MODE
+#define CFG_TUSB_RHPORT0_MODE       OPT_MODE_DEVICE
+#endif
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS                 OPT_OS_PICO
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE      64
+
+#define CFG_TUD_CDC                 1
+#define CFG_TUD_MSC                 0
+#define CFG_TUD_HID                 0
+#define CFG_TUD_MIDI                1
+#define CFG_TUD_VENDOR              0
+
+// the same as stdio_usb's own config
+#define CFG_TUD_CDC_RX_BUFSIZE      256
+#define CFG_TUD_CDC_TX_BUFSIZE      256
+
+// 32 packets; usb_midi.cc keeps the rest queued until there's room
+#define CFG_TUD_MIDI_RX_BUFSIZE     64
+#define CFG_TUD_MIDI_TX_BUFSIZE     128
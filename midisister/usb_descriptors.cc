@@ -0,0 +1,127 @@
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// the device is cdc (stdio, as before) plus usb-midi; see usb_midi.h
+
+namespace {
+
+// tinyusb's example ids, with the pid picking out the interfaces; fine for a one-off, not for shipping
+constexpr uint16_t UsbVid = 0xcafe;
+constexpr uint16_t UsbPid = 0x4000 | (1 << 0) /*cdc*/ | (1 << 3) /*midi*/;
+
+enum
+{
+    Itf_Cdc = 0,
+    Itf_CdcData,
+    Itf_Midi,
+    Itf_MidiStreaming,
+    Itf_Count,
+};
+
+enum
+{
+    Str_LangId = 0,
+    Str_Manufacturer,
+    Str_Product,
+    Str_Serial,
+    Str_Cdc,
+    Str_Midi,
+    Str_Count,
+};
+
+constexpr uint8_t Ep_CdcNotif = 0x81;
+constexpr uint8_t Ep_CdcOut = 0x02;
+constexpr uint8_t Ep_CdcIn = 0x82;
+constexpr uint8_t Ep_MidiOut = 0x03;
+constexpr uint8_t Ep_MidiIn = 0x83;
+
+constexpr uint16_t ConfigTotalLen = TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN;
+
+const tusb_desc_device_t DeviceDesc =
+{
+    .bLength            = sizeof(tusb_desc_device_t),
+    .bDescriptorType    = TUSB_DESC_DEVICE,
+    .bcdUSB             = 0x0200,
+    // cdc is two interfaces, so everything's grouped with iads
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor           = UsbVid,
+    .idProduct          = UsbPid,
+    .bcdDevice          = 0x0100,
+    .iManufacturer      = Str_Manufacturer,
+    .iProduct           = Str_Product,
+    .iSerialNumber      = Str_Serial,
+    .bNumConfigurations = 1,
+};
+
+const uint8_t ConfigDesc[] =
+{
+    TUD_CONFIG_DESCRIPTOR(1, Itf_Count, 0, ConfigTotalLen, 0, 100),
+    TUD_CDC_DESCRIPTOR(Itf_Cdc, Str_Cdc, Ep_CdcNotif, 8, Ep_CdcOut, Ep_CdcIn, 64),
+    TUD_MIDI_DESCRIPTOR(Itf_Midi, Str_Midi, Ep_MidiOut, Ep_MidiIn, 64),
+};
+static_assert(sizeof(ConfigDesc) == ConfigTotalLen);
+
+const char* const Strings[Str_Count] =
+{
+    nullptr,            // language id; see below
+    "TheRealMolen",
+    "midisister",
+    nullptr,            // the board's unique id
+    "midisister console",
+    "midisister",
+};
+
+}
+
+
+extern "C" const uint8_t* tud_descriptor_device_cb()
+{
+    return (const uint8_t*)&DeviceDesc;
+}
+
+extern "C" const uint8_t* tud_descriptor_configuration_cb(uint8_t /*index*/)
+{
+    return ConfigDesc;
+}
+
+extern "C" const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t /*langid*/)
+{
+    constexpr uint MaxChars = 32;
+    static uint16_t desc[MaxChars + 1];
+
+    uint numChars;
+    if (index == Str_LangId)
+    {
+        desc[1] = 0x0409;   // english
+        numChars = 1;
+    }
+    else if (index < Str_Count)
+    {
+        char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+        const char* str = Strings[index];
+        if (index == Str_Serial)
+        {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            str = serial;
+        }
+
+        numChars = std::min<uint>(strlen(str), MaxChars);
+        for (uint i=0; i<numChars; ++i)
+            desc[1 + i] = uint16_t(str[i]);
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    // the first word is the length in bytes (including itself) & the descriptor type
+    desc[0] = uint16_t((TUSB_DESC_STRING << 8) | (2 * numChars + 2));
+    return desc;
+}
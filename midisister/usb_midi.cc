@@ -0,0 +1,152 @@
+#include "usb_midi.h"
+#include "ring_buffer.h"
+
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "tusb.h"
+#include <algorithm>
+
+
+namespace {
+
+// 256 packets is well over a second of the busiest mappings; usb drains it far faster than that
+constexpr uint32_t QueueSize = 256;
+
+RingBuffer<UsbMidiPacket, QueueSize> Queue;
+UsbMidiStats Stats;
+
+// tinyusb's own irq & the user irq stdio_usb claims to run tud_task from. nothing else here
+// claims a user irq, and stdio_usb only claims its one in stdio_usb_init, so this is worked out
+// on first use rather than in usb_midi_init
+uint32_t UsbIrqMask = 0;
+
+uint32_t find_usb_irqs()
+{
+    uint32_t mask = 1u << USBCTRL_IRQ;
+    for (uint irq=FIRST_USER_IRQ; irq<NUM_IRQS; ++irq)
+    {
+        if (user_irq_is_claimed(irq))
+            mask |= 1u << irq;
+    }
+    return mask;
+}
+
+}
+
+
+bool usb_midi_packetise(uint8_t cable, const uint8_t* message, uint32_t len, UsbMidiPacket& out)
+{
+    if (len == 0 || !(message[0] & 0x80))
+        return false;
+
+    const uint8_t status = message[0];
+    uint8_t cin;
+    uint32_t expectedLen;
+    if (status < 0xf0)
+    {
+        // channel voice messages use their own status nibble as the code index
+        cin = status >> 4;
+        expectedLen = (cin == 0xc || cin == 0xd) ? 2 : 3;
+    }
+    else if (status >= 0xf8)
+    {
+        // realtime; a single byte
+        cin = 0xf;
+        expectedLen = 1;
+    }
+    else switch (status)
+    {
+        case 0xf1: case 0xf3:   cin = 0x2; expectedLen = 2; break;
+        case 0xf2:              cin = 0x3; expectedLen = 3; break;
+        case 0xf6:              cin = 0x5; expectedLen = 1; break;
+        default:                return false;   // sysex, or undefined
+    }
+
+    if (len != expectedLen)
+        return false;
+
+    out.header = uint8_t((cable << 4) | cin);
+    for (uint32_t i=0; i<3; ++i)
+        out.midi[i] = (i < len) ? message[i] : 0;
+    return true;
+}
+
+
+void usb_midi_init()
+{
+    tusb_init();
+}
+
+bool usb_midi_queue(const uint8_t* message, uint32_t len)
+{
+    // nobody's listening; don't let a backlog build up for when they do
+    if (!usb_midi_is_connected())
+    {
+        ++Stats.packetsUnplugged;
+        return false;
+    }
+
+    UsbMidiPacket packet;
+    if (!usb_midi_packetise(0, message, len, packet))
+        return false;
+
+    if (!Queue.push(packet))
+    {
+        ++Stats.packetsDropped;
+        return false;
+    }
+
+    ++Stats.packetsQueued;
+    Stats.peakQueued = std::max(Stats.peakQueued, Queue.size());
+    return true;
+}
+
+void usb_midi_update()
+{
+    if (!usb_midi_is_connected())
+    {
+        Queue.clear();
+        return;
+    }
+
+    // tud_task runs from stdio_usb's low priority irq, and tinyusb's endpoint bookkeeping isn't
+    // safe against it (or its own irq) without an rtos; keep those out while we're writing, but
+    // leave the uart & clock irqs running
+    if (!UsbIrqMask)
+        UsbIrqMask = find_usb_irqs();
+
+    uint32_t maskedIrqs = 0;
+    for (uint irq=0; irq<NUM_IRQS; ++irq)
+    {
+        if ((UsbIrqMask & (1u << irq)) && irq_is_enabled(irq))
+            maskedIrqs |= 1u << irq;
+    }
+    irq_set_mask_enabled(maskedIrqs, false);
+
+    while (!Queue.empty() && tud_midi_packet_write((const uint8_t*)&Queue.peek()))
+    {
+        Queue.drop();
+        ++Stats.packetsSent;
+    }
+    irq_set_mask_enabled(maskedIrqs, true);
+}
+
+bool usb_midi_is_connected()
+{
+    return tud_midi_mounted();
+}
+
+uint32_t usb_midi_queued()
+{
+    return Queue.size();
+}
+
+const UsbMidiStats& usb_midi_get_stats()
+{
+    return Stats;
+}
+
+void usb_midi_reset_stats()
+{
+    Stats = UsbMidiStats{};
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+
+// usb-midi 1.0 event packet: the cable number & a code index (what sort of message follows) in
+// the top & bottom nibbles of the header, then the message itself, zero padded to 3 bytes
+struct UsbMidiPacket
+{
+    uint8_t header;
+    uint8_t midi[3];
+};
+static_assert(sizeof(UsbMidiPacket) == 4);
+
+struct UsbMidiStats
+{
+    uint32_t packetsQueued = 0;
+    uint32_t packetsSent = 0;       // handed over to tinyusb
+    uint32_t packetsDropped = 0;    // didn't fit in the queue
+    uint32_t packetsUnplugged = 0;  // thrown away because no host had the device open
+    uint32_t peakQueued = 0;
+};
+
+
+// false (and out is untouched) for anything that doesn't fit in one packet, ie. sysex
+bool usb_midi_packetise(uint8_t cable, const uint8_t* message, uint32_t len, UsbMidiPacket& out);
+
+// the usb device is ours (cdc + midi; see usb_descriptors.cc) and stdio_usb just uses its cdc
+// interface, so this has to come before stdio_usb_init
+void usb_midi_init();
+
+// NB. never blocks; packets wait in a queue until usb_midi_update hands them to tinyusb
+bool usb_midi_queue(const uint8_t* message, uint32_t len);
+// call often; tinyusb only has room for a few packets at a time
+void usb_midi_update();
+
+bool usb_midi_is_connected();
+uint32_t usb_midi_queued();
+const UsbMidiStats& usb_midi_get_stats();
+void usb_midi_reset_stats();
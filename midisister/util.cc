@@ -1,4 +1,5 @@
 #include "util.h"
+#include "profile.h"
 
 #include "pico/stdlib.h"
 
@@ -31,8 +32,28 @@ bool hasErrorHappened()
 }
 
 
+uint32_t crc32(const void* data, uint32_t len, uint32_t crc)
+{
+    // a nibble at a time; a fraction of the size of the usual 1KB table and plenty quick for config saves
+    static const uint32_t NibbleTable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    crc = ~crc;
+    for (const uint8_t* p = (const uint8_t*)data; len; --len, ++p)
+    {
+        crc = NibbleTable[(crc ^ *p) & 0x0f] ^ (crc >> 4);
+        crc = NibbleTable[(crc ^ (*p >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+
 void StdinAsync::update()
 {
+    PROFILE_STAGE(Stdin);
+
     for (;;)
     {
         int nextChar = getchar_timeout_us(0);
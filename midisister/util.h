@@ -7,6 +7,15 @@
 
 using byte = uint8_t;
 
+// Q15 fixed point, ie. 1.0 == 1 << 15
+// the M0+ has no fpu, so everything between a raw sensor reading and a midi value stays in integers
+using fixed = int32_t;
+constexpr int FixedShift = 15;
+constexpr fixed FixedOne = fixed(1) << FixedShift;
+
+constexpr fixed fixed_from_float(float f)   { return fixed(f * float(FixedOne) + ((f >= 0.f) ? 0.5f : -0.5f)); }
+constexpr float fixed_to_float(fixed f)     { return float(f) * (1.f / float(FixedOne)); }
+
 
 class StdinAsync
 {
@@ -73,6 +82,10 @@ void print_buf(const Buf& buf)
 
 
 
+// standard (zlib) crc32; pass the previous result back in to carry on over more data
+uint32_t crc32(const void* data, uint32_t len, uint32_t crc = 0);
+
+
 template<typename Integral>
 inline Integral div_round_up(Integral val, Integral boundary)
 {
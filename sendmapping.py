@@ -24,7 +24,7 @@ def get_clean_mapping(mappingname):
         return ' '.join(lines) + '\n'
 
 
-def send_mapping(serialPortName, mappingname):
+def send_mapping(serialPortName, mappingname, preset=None):
     try:
         mappingStr = get_mapping(mappingname)
     except FileNotFoundError as e:
@@ -32,6 +32,9 @@ def send_mapping(serialPortName, mappingname):
         sys.exit(2)
 
     with serial.Serial(serialPortName, 115200, timeout=1) as ser:
+        if preset is not None:
+            # only picks the slot the upload's saved to; 'preset <n>' is what switches the live one
+            ser.write(('edit %d\n' % preset).encode('utf-8'))
         ser.write(mappingStr.encode('utf-8'))
         res = ser.read(2000)
 
@@ -40,8 +43,9 @@ def send_mapping(serialPortName, mappingname):
 
 
 if __name__ == '__main__':
-    if len(sys.argv) != 3:
-        print('USAGE: ' + sys.argv[0] + ' <serialport> <mappingname>\n\n   e.g. ' + sys.argv[0] + ' COM8 hydra0', file=sys.stderr)
+    if len(sys.argv) not in (3, 4):
+        print('USAGE: ' + sys.argv[0] + ' <serialport> <mappingname> [preset]\n\n   e.g. ' + sys.argv[0] + ' COM8 hydra0 1', file=sys.stderr)
         sys.exit(1)
 
-    send_mapping(sys.argv[1], sys.argv[2])
+    preset = int(sys.argv[3]) if len(sys.argv) == 4 else None
+    send_mapping(sys.argv[1], sys.argv[2], preset)
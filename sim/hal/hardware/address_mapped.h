@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+
+typedef volatile uint32_t io_rw_32;
+
+inline void hw_set_bits(io_rw_32* addr, uint32_t mask)      { *addr = *addr | mask; }
+inline void hw_clear_bits(io_rw_32* addr, uint32_t mask)    { *addr = *addr & ~mask; }
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+#define FLASH_PAGE_SIZE     (1u << 8)
+#define FLASH_SECTOR_SIZE   (1u << 12)
+
+// like the real thing, programming can only clear bits and offsets must be page/sector aligned
+extern "C" {
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+#define I2C_IC_DATA_CMD_DAT_BITS            0x000000ffu
+#define I2C_IC_DATA_CMD_CMD_BITS            0x00000100u
+#define I2C_IC_DATA_CMD_STOP_BITS           0x00000200u
+#define I2C_IC_DATA_CMD_RESTART_BITS        0x00000400u
+#define I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS   0x00000040u
+#define I2C_IC_ENABLE_ENABLE_BITS           0x00000001u
+#define I2C_IC_ENABLE_STATUS_IC_EN_BITS     0x00000001u
+
+// writes queue commands for the simulated nunchuk; reads pop received bytes
+struct SimI2cDataCmdReg
+{
+    int index;
+    SimI2cDataCmdReg& operator=(uint32_t val);
+    operator uint32_t() const;
+};
+
+// disabling the controller drops any queued commands & unread bytes
+struct SimI2cEnableReg
+{
+    int index;
+    SimI2cEnableReg& operator=(uint32_t val);
+    operator uint32_t() const;
+};
+
+typedef struct
+{
+    SimI2cDataCmdReg data_cmd;
+    SimI2cEnableReg enable;
+    uint32_t enable_status;
+    uint32_t raw_intr_stat;
+    uint32_t clr_tx_abrt;
+} i2c_hw_t;
+
+typedef struct i2c_inst
+{
+    int index;
+    i2c_hw_t hw;
+} i2c_inst_t;
+
+extern i2c_inst_t sim_i2cs[2];
+#define i2c0    (&sim_i2cs[0])
+#define i2c1    (&sim_i2cs[1])
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+inline i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c)            { return &i2c->hw; }
+size_t i2c_get_read_available(i2c_inst_t* i2c);
+int i2c_write_blocking(i2c_inst_t* i2c, uint8_t addr, const uint8_t* src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t* i2c, uint8_t addr, uint8_t* dst, size_t len, bool nostop);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+#define NUM_IRQS        32
+// one per hardware alarm; see hardware/timer.h
+#define TIMER_IRQ_0     0
+#define TIMER_IRQ_1     1
+#define TIMER_IRQ_2     2
+// the default alarm pool's, which the repeating timers run from
+#define TIMER_IRQ_3     3
+#define USBCTRL_IRQ     5
+// spare irqs that software can claim & raise; stdio_usb runs tud_task from one
+#define NUM_USER_IRQS   6
+#define FIRST_USER_IRQ  (NUM_IRQS - NUM_USER_IRQS)
+
+typedef void (*irq_handler_t)();
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+bool irq_is_enabled(uint num);
+void irq_set_mask_enabled(uint32_t mask, bool enabled);
+bool user_irq_is_claimed(uint irq_num);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "pico/stdlib.h"
+#include "hardware/address_mapped.h"
+#include "hardware/irq.h"
+
+
+// the timer's hardware alarms, for code that drives one directly rather than through the alarm
+// pool (which has alarm 3). writing a target to alarm[] arms it; it fires once the low 32 bits of
+// the time reach it, disarming itself and raising intr. armed & intr are write 1 to clear
+// NB. the real one only fires on an exact match, so a target that's already gone by waits for
+// the counter to wrap; the sim fires it straight away
+struct SimAlarmReg
+{
+    int index;
+    SimAlarmReg& operator=(uint32_t val);
+    operator uint32_t() const;
+};
+
+struct SimW1cReg
+{
+    uint32_t bits;
+    SimW1cReg& operator=(uint32_t val)  { bits &= ~val; return *this; }
+    operator uint32_t() const           { return bits; }
+};
+
+#define NUM_TIMERS  4
+
+typedef struct
+{
+    SimAlarmReg alarm[NUM_TIMERS];
+    SimW1cReg armed;
+    SimW1cReg intr;
+    io_rw_32 inte;
+} timer_hw_t;
+
+extern timer_hw_t sim_timer_hw;
+#define timer_hw    (&sim_timer_hw)
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "pico/stdlib.h"
+#include "hardware/address_mapped.h"
+
+
+// writes to dr go into the simulated tx fifo, and reads come from the rx one
+struct SimUartDataReg
+{
+    int index;
+    SimUartDataReg& operator=(uint32_t val);
+    operator uint32_t() const;
+};
+
+// tx is raised while the fifo is at or below 1/8 full, rx while it's at least 1/8 full, and the
+// receive timeout while there's anything in the rx fifo and nothing's arrived for 32 bit times
+#define UART_UARTIMSC_RTIM_BITS     0x00000040u
+#define UART_UARTIMSC_TXIM_BITS     0x00000020u
+#define UART_UARTIMSC_RXIM_BITS     0x00000010u
+
+// error flags that come with each received byte
+#define UART_UARTDR_OE_BITS         0x00000800u
+#define UART_UARTDR_BE_BITS         0x00000400u
+#define UART_UARTDR_PE_BITS         0x00000200u
+#define UART_UARTDR_FE_BITS         0x00000100u
+
+typedef struct
+{
+    SimUartDataReg dr;
+    io_rw_32 imsc;
+} uart_hw_t;
+
+typedef struct uart_inst
+{
+    int index;
+    uart_hw_t hw;
+} uart_inst_t;
+
+extern uart_inst_t sim_uarts[2];
+#define uart0   (&sim_uarts[0])
+#define uart1   (&sim_uarts[1])
+
+#define UART0_IRQ   20
+#define UART1_IRQ   21
+
+uint uart_init(uart_inst_t* uart, uint baudrate);
+inline uint uart_get_index(uart_inst_t* uart)           { return uint(uart->index); }
+inline uart_hw_t* uart_get_hw(uart_inst_t* uart)        { return &uart->hw; }
+bool uart_is_writable(uart_inst_t* uart);
+bool uart_is_readable(uart_inst_t* uart);
+void uart_set_irq_enables(uart_inst_t* uart, bool rx_has_data, bool tx_needs_data);
+void uart_tx_wait_blocking(uart_inst_t* uart);
+void uart_write_blocking(uart_inst_t* uart, const uint8_t* src, size_t len);
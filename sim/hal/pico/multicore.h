@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+// the sim only has the one core; the lockout just keeps count, and of any that nothing would
+// have answered (see sim::get_stuck_lockouts)
+void multicore_lockout_victim_init();
+void multicore_lockout_start_blocking();
+void multicore_lockout_end_blocking();
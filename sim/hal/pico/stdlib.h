@@ -0,0 +1,73 @@
+#pragma once
+
+// host stand-in for the parts of the pico sdk that midisister uses
+// time is virtual; it only moves when the firmware sleeps or spins, or when the sim's main advances it
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <sys/types.h>
+
+
+typedef uint64_t absolute_time_t;
+
+absolute_time_t get_absolute_time();
+inline uint32_t to_ms_since_boot(absolute_time_t t)     { return uint32_t(t / 1000); }
+uint32_t time_us_32();
+uint64_t time_us_64();
+
+// repeating timers fire as irqs while time advances; a negative delay is measured between due times
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+struct repeating_timer
+{
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void* user_data;
+    uint64_t sim_due_us;
+};
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
+
+// one shot alarms, from the same pool; a callback that returns anything but 0 isn't rescheduled
+// as the sdk would, so don't. one that's already due with fire_if_past is called straight away
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void* user_data);
+inline absolute_time_t from_us_since_boot(uint64_t us)  { return us; }
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void* user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t alarm_id);
+
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+void tight_loop_contents();
+
+#define PICO_ERROR_NONE      0
+#define PICO_ERROR_TIMEOUT  -1
+#define PICO_ERROR_GENERIC  -2
+int getchar_timeout_us(uint32_t timeout_us);
+bool stdio_usb_init();
+
+#define GPIO_OUT    1
+#define GPIO_IN     0
+enum gpio_function
+{
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+};
+inline void gpio_init(uint)                             {}
+inline void gpio_set_dir(uint, bool)                    {}
+inline void gpio_put(uint, bool)                        {}
+inline void gpio_pull_up(uint)                          {}
+inline void gpio_set_function(uint, gpio_function)      {}
+
+// flash is a ram array; see hardware/flash.h
+#define PICO_FLASH_SIZE_BYTES   (2 * 1024 * 1024)
+extern uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE    (uintptr_t(sim_flash))
+
+#define __not_in_flash_func(func_name)              func_name
+#define __no_inline_not_in_flash_func(func_name)    func_name
+#define __time_critical_func(func_name)             func_name
+#define __force_inline                              inline __attribute__((always_inline))
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+
+// just the usb-midi part of tinyusb; the simulated host opens the device straight away and reads
+// its midi endpoint once per (1ms) usb frame
+bool tusb_init();
+bool tud_midi_mounted();
+bool tud_midi_packet_write(const uint8_t packet[4]);
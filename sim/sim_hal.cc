@@ -0,0 +1,925 @@
+#include "sim_hal.h"
+
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/uart.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+
+
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+uart_inst_t sim_uarts[2] = { { 0, { { 0 }, 0 } }, { 1, { { 1 }, 0 } } };
+i2c_inst_t sim_i2cs[2] = { { 0, { { 0 }, { 0 }, 1, 0, 0 } }, { 1, { { 1 }, { 1 }, 1, 0, 0 } } };
+timer_hw_t sim_timer_hw = { { { 0 }, { 1 }, { 2 }, { 3 } }, { 0 }, { 0 }, 0 };
+
+
+namespace {
+
+// advancing time in small steps keeps irq delivery close to when it'd really happen
+constexpr uint64_t MaxStepUs = 20;
+
+uint64_t NowUs = 0;
+bool InterruptsEnabled = true;
+uint32_t IrqsEnabled = 1u << TIMER_IRQ_3;    // the sdk's runtime init turns the alarm pool's on
+bool InIrq = false;
+sim::Stats SimStats;
+int FlashOpsLeft = -1;
+bool LockoutVictimReady = false;
+uint32_t Lockouts = 0;
+uint32_t StuckLockouts = 0;
+
+
+bool flash_has_power()
+{
+    if (FlashOpsLeft == 0)
+        return false;
+    if (FlashOpsLeft > 0)
+        --FlashOpsLeft;
+    return true;
+}
+
+
+//  uart
+//
+constexpr uint UartBaud = 31250;
+constexpr uint64_t UartByteUs = (10 * 1000 * 1000) / UartBaud;
+constexpr size_t UartFifoDepth = 32;
+constexpr size_t UartTxIrqLevel = UartFifoDepth / 8;
+constexpr size_t UartRxIrqLevel = UartFifoDepth / 8;
+constexpr uint64_t UartRxTimeoutUs = 32 * UartByteUs / 10;
+
+struct FifoEntry
+{
+    uint64_t pushedUs;
+    uint8_t  val;
+};
+
+struct SimUart
+{
+    std::deque<FifoEntry> txFifo;
+    uint64_t shifterDoneUs = 0;
+    irq_handler_t handler = nullptr;
+
+    std::deque<FifoEntry> rxWire;       // pushedUs is when the byte's finished arriving
+    std::deque<uint16_t> rxFifo;        // with the error flags, as dr reads them
+    uint64_t rxLastUs = 0;
+    bool rxOverrun = false;
+
+    bool rxIrqDue(uint32_t imsc) const
+    {
+        if (rxFifo.empty())
+            return false;
+        return ((imsc & UART_UARTIMSC_RXIM_BITS) && rxFifo.size() >= UartRxIrqLevel) ||
+            ((imsc & UART_UARTIMSC_RTIM_BITS) && NowUs - rxLastUs >= UartRxTimeoutUs);
+    }
+};
+SimUart Uarts[2];
+std::vector<sim::WireByte> WireBytes;
+
+// tracks message boundaries on the wire so latency can be measured per message
+uint8_t WireRunningStatus = 0;
+uint WireDataNeeded = 0;
+uint64_t PendingInputChangeUs = 0;
+bool InputChangePending = false;
+bool UsbInputChangePending = false;
+uint64_t PendingUsbInputChangeUs = 0;
+
+uint midi_data_len(uint8_t status)
+{
+    switch (status & 0xf0)
+    {
+        case 0xc0: case 0xd0:   return 1;
+        case 0xf0:
+            if (status == 0xf1 || status == 0xf3) return 1;
+            if (status == 0xf2) return 2;
+            return 0;
+        default:                return 2;
+    }
+}
+
+void on_wire_byte(uint64_t doneUs, uint8_t val)
+{
+    WireBytes.push_back({ doneUs, val });
+
+    bool complete = false;
+    if (val >= 0xf8)
+    {
+        // realtime; doesn't disturb anything
+        complete = true;
+    }
+    else if (val & 0x80)
+    {
+        WireRunningStatus = (val < 0xf0) ? val : 0;
+        WireDataNeeded = midi_data_len(val);
+        complete = (WireDataNeeded == 0);
+    }
+    else if (WireDataNeeded > 0 || WireRunningStatus)
+    {
+        if (WireDataNeeded == 0)
+            WireDataNeeded = midi_data_len(WireRunningStatus);
+        --WireDataNeeded;
+        complete = (WireDataNeeded == 0);
+    }
+
+    if (!complete)
+        return;
+
+    ++SimStats.midiMessages;
+    if (InputChangePending && doneUs >= PendingInputChangeUs)
+    {
+        SimStats.wireLatency.add(uint32_t(doneUs - PendingInputChangeUs));
+        InputChangePending = false;
+    }
+}
+
+//  usb
+//
+// full speed usb polls the midi in endpoint once a frame, and a 64 byte packet holds 16 events
+constexpr uint64_t UsbFrameUs = 1000;
+constexpr size_t UsbEventsPerFrame = 16;
+constexpr size_t UsbFifoDepth = 32;     // CFG_TUD_MIDI_TX_BUFSIZE / 4
+
+bool UsbConnected = true;
+std::deque<FifoEntry> UsbFifo;          // just the times matter
+uint64_t UsbNextFrameUs = 0;
+
+void update_usb()
+{
+    if (NowUs < UsbNextFrameUs)
+        return;
+    UsbNextFrameUs = NowUs - (NowUs % UsbFrameUs) + UsbFrameUs;
+
+    for (size_t i=0; i<UsbEventsPerFrame && !UsbFifo.empty(); ++i)
+    {
+        ++SimStats.usbPackets;
+        if (UsbInputChangePending && NowUs >= PendingUsbInputChangeUs)
+        {
+            SimStats.usbLatency.add(uint32_t(NowUs - PendingUsbInputChangeUs));
+            UsbInputChangePending = false;
+        }
+        UsbFifo.pop_front();
+    }
+}
+
+void update_uart(SimUart& uart)
+{
+    while (!uart.rxWire.empty() && uart.rxWire.front().pushedUs <= NowUs)
+    {
+        if (uart.rxFifo.size() < UartFifoDepth)
+        {
+            uart.rxFifo.push_back(uint16_t(uart.rxWire.front().val | (uart.rxOverrun ? UART_UARTDR_OE_BITS : 0)));
+            uart.rxOverrun = false;
+        }
+        else
+        {
+            uart.rxOverrun = true;
+        }
+        uart.rxLastUs = uart.rxWire.front().pushedUs;
+        uart.rxWire.pop_front();
+    }
+
+    while (!uart.txFifo.empty())
+    {
+        const FifoEntry& next = uart.txFifo.front();
+        const uint64_t startUs = std::max(uart.shifterDoneUs, next.pushedUs);
+        if (startUs > NowUs)
+            break;
+
+        uart.shifterDoneUs = startUs + UartByteUs;
+        on_wire_byte(uart.shifterDoneUs, next.val);
+        uart.txFifo.pop_front();
+    }
+}
+
+
+//  nunchuk on i2c
+//
+constexpr uint8_t NunchukAddress = 0x52;
+constexpr uint64_t I2cByteUs = 90;      // 9 bits at 100kHz
+
+std::vector<sim::NunchukSample> Trace;
+size_t TraceIx = 0;
+bool NunchukConnected = true;
+uint8_t NunchukReg = 0;
+
+struct PendingRead
+{
+    uint64_t readyUs;
+    uint8_t  val;
+};
+std::deque<PendingRead> I2cRxFifo;
+uint64_t I2cBusFreeUs = 0;
+uint I2cStateBytesLeft = 0;
+
+const sim::NunchukSample& current_sample()
+{
+    static const sim::NunchukSample Idle;
+    return Trace.empty() ? Idle : Trace[TraceIx];
+}
+
+void update_trace()
+{
+    while (TraceIx + 1 < Trace.size() && Trace[TraceIx + 1].timeUs <= NowUs)
+    {
+        ++TraceIx;
+        if (Trace[TraceIx].sameInputsAs(Trace[TraceIx - 1]))
+            continue;
+
+        if (!InputChangePending)
+        {
+            InputChangePending = true;
+            PendingInputChangeUs = Trace[TraceIx].timeUs;
+        }
+        if (UsbConnected && !UsbInputChangePending)
+        {
+            UsbInputChangePending = true;
+            PendingUsbInputChangeUs = Trace[TraceIx].timeUs;
+        }
+    }
+}
+
+uint8_t read_nunchuk_reg(uint8_t reg)
+{
+    const sim::NunchukSample& s = current_sample();
+
+    // calibration that matches the sample defaults: 0g at 512, 1g at 716, joysticks 35..128..221
+    static const uint8_t Calibration[16] = {
+        512 >> 2, 512 >> 2, 512 >> 2, 0,
+        716 >> 2, 716 >> 2, 716 >> 2, 0,
+        221, 35, 128,  221, 35, 128,
+        0, 0,
+    };
+    static const uint8_t Ident[6] = { 0x00, 0x00, 0xa4, 0x20, 0x00, 0x00 };
+
+    if (reg < 6)
+    {
+        switch (reg)
+        {
+            case 0: return s.joyX;
+            case 1: return s.joyY;
+            case 2: return uint8_t(s.accelX >> 2);
+            case 3: return uint8_t(s.accelY >> 2);
+            case 4: return uint8_t(s.accelZ >> 2);
+            default:
+                return uint8_t((s.btnZ ? 0 : 1) | (s.btnC ? 0 : 2) |
+                    ((s.accelX & 3) << 2) | ((s.accelY & 3) << 4) | ((s.accelZ & 3) << 6));
+        }
+    }
+    if (reg >= 0x20 && reg < 0x30)
+        return Calibration[reg - 0x20];
+    if (reg >= 0xfa)
+        return Ident[reg - 0xfa];
+
+    return 0;
+}
+
+
+void service_irqs()
+{
+    if (!InterruptsEnabled || InIrq)
+        return;
+
+    for (uint i=0; i<2; ++i)
+    {
+        SimUart& uart = Uarts[i];
+        const bool irqEnabled = (IrqsEnabled & (1u << (UART0_IRQ + i))) != 0;
+
+        // the handler should either fill the fifo or turn the irq off; don't spin if it does neither
+        for (uint guard=0; guard<4; ++guard)
+        {
+            const uint32_t imsc = sim_uarts[i].hw.imsc;
+            const bool txIrqDue = (imsc & UART_UARTIMSC_TXIM_BITS) && uart.txFifo.size() <= UartTxIrqLevel;
+            if (!irqEnabled || !uart.handler || (!txIrqDue && !uart.rxIrqDue(imsc)))
+                break;
+
+            InIrq = true;
+            uart.handler();
+            InIrq = false;
+        }
+    }
+}
+
+//  timers
+//
+// the hardware alarms that firmware drives directly; the pool's alarm 3 is modelled by the
+// repeating timers & alarms below instead
+uint32_t AlarmTargets[NUM_TIMERS] = {};
+irq_handler_t AlarmHandlers[NUM_TIMERS] = {};
+uint32_t ClaimedAlarms = 1u << 3;
+
+void service_hw_alarms()
+{
+    for (uint i=0; i<NUM_TIMERS; ++i)
+    {
+        const uint32_t bit = 1u << i;
+        if ((sim_timer_hw.armed.bits & bit) && int32_t(uint32_t(NowUs) - AlarmTargets[i]) >= 0)
+        {
+            sim_timer_hw.armed.bits &= ~bit;
+            sim_timer_hw.intr.bits |= bit;
+        }
+    }
+
+    if (!InterruptsEnabled || InIrq)
+        return;
+
+    for (uint i=0; i<NUM_TIMERS; ++i)
+    {
+        const uint32_t bit = 1u << i;
+        const bool irqEnabled = (IrqsEnabled & (1u << (TIMER_IRQ_0 + i))) != 0;
+        if (!irqEnabled || !AlarmHandlers[i] || !(sim_timer_hw.intr.bits & sim_timer_hw.inte & bit))
+            continue;
+
+        InIrq = true;
+        AlarmHandlers[i]();
+        InIrq = false;
+    }
+}
+
+std::vector<repeating_timer_t*> Timers;
+
+struct Alarm
+{
+    alarm_id_t id;
+    uint64_t dueUs;
+    alarm_callback_t callback;
+    void* userData;
+};
+std::vector<Alarm> Alarms;
+alarm_id_t NextAlarmId = 1;
+
+void service_timers()
+{
+    service_hw_alarms();
+
+    if (!InterruptsEnabled || InIrq || !(IrqsEnabled & (1u << TIMER_IRQ_3)))
+        return;
+
+    for (size_t i=0; i<Alarms.size(); )
+    {
+        if (Alarms[i].dueUs > NowUs)
+        {
+            ++i;
+            continue;
+        }
+
+        const Alarm alarm = Alarms[i];
+        Alarms.erase(Alarms.begin() + i);
+        InIrq = true;
+        alarm.callback(alarm.id, alarm.userData);
+        InIrq = false;
+        // the callback may have added or cancelled alarms
+        i = 0;
+    }
+
+    for (size_t i=0; i<Timers.size(); )
+    {
+        repeating_timer_t* timer = Timers[i];
+        if (timer->sim_due_us > NowUs)
+        {
+            ++i;
+            continue;
+        }
+
+        InIrq = true;
+        const bool keepGoing = timer->callback(timer);
+        InIrq = false;
+
+        if (!keepGoing)
+        {
+            Timers.erase(Timers.begin() + i);
+            continue;
+        }
+
+        const uint64_t periodUs = uint64_t((timer->delay_us < 0) ? -timer->delay_us : timer->delay_us);
+        timer->sim_due_us = (timer->delay_us < 0) ? timer->sim_due_us + periodUs : NowUs + periodUs;
+        ++i;
+    }
+}
+
+std::string ConsoleInput;
+size_t ConsolePos = 0;
+
+}
+
+
+void sim::Latency::add(uint32_t us)
+{
+    ++count;
+    totalUs += us;
+    minUs = std::min(minUs, us);
+    maxUs = std::max(maxUs, us);
+}
+
+bool sim::NunchukSample::sameInputsAs(const NunchukSample& other) const
+{
+    return joyX == other.joyX && joyY == other.joyY &&
+        accelX == other.accelX && accelY == other.accelY && accelZ == other.accelZ &&
+        btnC == other.btnC && btnZ == other.btnZ;
+}
+
+uint64_t sim::now_us()
+{
+    return NowUs;
+}
+
+void sim::advance_us(uint64_t us)
+{
+    const uint64_t endUs = NowUs + us;
+    do
+    {
+        NowUs = std::min(NowUs + MaxStepUs, endUs);
+        update_trace();
+        for (SimUart& uart : Uarts)
+            update_uart(uart);
+        update_usb();
+        service_irqs();
+        service_timers();
+    }
+    while (NowUs < endUs);
+}
+
+void sim::set_nunchuk_trace(std::vector<NunchukSample> trace)
+{
+    Trace = std::move(trace);
+    for (NunchukSample& sample : Trace)
+        sample.timeUs += uint32_t(NowUs);
+    TraceIx = 0;
+    InputChangePending = false;
+    UsbInputChangePending = false;
+}
+
+void sim::set_nunchuk_connected(bool connected)
+{
+    NunchukConnected = connected;
+}
+
+void sim::queue_console_input(const std::string& text)
+{
+    ConsoleInput += text;
+}
+
+bool sim::console_input_pending()
+{
+    return ConsolePos < ConsoleInput.size();
+}
+
+void sim::set_usb_connected(bool connected)
+{
+    UsbConnected = connected;
+    if (!connected)
+    {
+        UsbFifo.clear();
+        UsbInputChangePending = false;
+    }
+}
+
+void sim::queue_midi_input(const std::vector<uint8_t>& bytes, uint64_t atUs)
+{
+    SimUart& uart = Uarts[0];
+    uint64_t doneUs = std::max(atUs, NowUs);
+    if (!uart.rxWire.empty())
+        doneUs = std::max(doneUs, uart.rxWire.back().pushedUs);
+
+    for (uint8_t b : bytes)
+    {
+        doneUs += UartByteUs;
+        uart.rxWire.push_back({ doneUs, b });
+    }
+}
+
+bool sim::midi_input_pending()
+{
+    return !Uarts[0].rxWire.empty() || !Uarts[0].rxFifo.empty();
+}
+
+void sim::erase_flash()
+{
+    memset(sim_flash, 0xff, sizeof(sim_flash));
+}
+
+void sim::set_flash_power_cut(int opsLeft)
+{
+    FlashOpsLeft = opsLeft;
+}
+
+uint32_t sim::get_lockouts()
+{
+    return Lockouts;
+}
+
+uint32_t sim::get_stuck_lockouts()
+{
+    return StuckLockouts;
+}
+
+const std::vector<sim::WireByte>& sim::get_wire_bytes()
+{
+    return WireBytes;
+}
+
+const sim::Stats& sim::get_stats()
+{
+    return SimStats;
+}
+
+void sim::reset_stats()
+{
+    SimStats = {};
+    InputChangePending = false;
+    UsbInputChangePending = false;
+}
+
+
+//  pico/stdlib.h
+//
+absolute_time_t get_absolute_time()     { return NowUs; }
+uint32_t time_us_32()                   { return uint32_t(NowUs); }
+uint64_t time_us_64()                   { return NowUs; }
+
+void sleep_ms(uint32_t ms)              { sim::advance_us(uint64_t(ms) * 1000); }
+void sleep_us(uint64_t us)              { sim::advance_us(us); }
+void busy_wait_us_32(uint32_t us)       { sim::advance_us(us); }
+void tight_loop_contents()              { sim::advance_us(1); }
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out)
+{
+    assert(delay_us != 0);
+    out->delay_us = delay_us;
+    out->callback = callback;
+    out->user_data = user_data;
+    out->sim_due_us = NowUs + uint64_t((delay_us < 0) ? -delay_us : delay_us);
+
+    cancel_repeating_timer(out);
+    Timers.push_back(out);
+    return true;
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer)
+{
+    auto it = std::find(Timers.begin(), Timers.end(), timer);
+    if (it == Timers.end())
+        return false;
+
+    Timers.erase(it);
+    return true;
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void* user_data, bool fire_if_past)
+{
+    if (time <= NowUs)
+    {
+        if (fire_if_past)
+            callback(0, user_data);
+        return 0;
+    }
+
+    const alarm_id_t id = NextAlarmId++;
+    Alarms.push_back({ id, time, callback, user_data });
+    return id;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id)
+{
+    auto it = std::find_if(Alarms.begin(), Alarms.end(), [=](const Alarm& alarm) { return alarm.id == alarm_id; });
+    if (it == Alarms.end())
+        return false;
+
+    Alarms.erase(it);
+    return true;
+}
+
+int getchar_timeout_us(uint32_t)
+{
+    if (ConsolePos >= ConsoleInput.size())
+        return PICO_ERROR_TIMEOUT;
+
+    return (unsigned char)ConsoleInput[ConsolePos++];
+}
+
+bool stdio_usb_init()                   { return true; }
+
+
+//  hardware/sync.h & irq.h
+//
+uint32_t save_and_disable_interrupts()
+{
+    const uint32_t status = InterruptsEnabled ? 1 : 0;
+    InterruptsEnabled = false;
+    return status;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    InterruptsEnabled = (status != 0);
+    service_irqs();
+    service_timers();
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    if (num == UART0_IRQ || num == UART1_IRQ)
+        Uarts[num - UART0_IRQ].handler = handler;
+    else if (num < TIMER_IRQ_0 + NUM_TIMERS)
+        AlarmHandlers[num - TIMER_IRQ_0] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    irq_set_mask_enabled(1u << num, enabled);
+}
+
+bool irq_is_enabled(uint num)
+{
+    return (IrqsEnabled & (1u << num)) != 0;
+}
+
+void irq_set_mask_enabled(uint32_t mask, bool enabled)
+{
+    if (enabled)
+    {
+        IrqsEnabled |= mask;
+        service_irqs();
+        service_timers();
+    }
+    else
+    {
+        IrqsEnabled &= ~mask;
+    }
+}
+
+// the sim's usb has no irqs; nothing claims a user irq
+bool user_irq_is_claimed(uint)
+{
+    return false;
+}
+
+
+//  hardware/timer.h
+//
+SimAlarmReg& SimAlarmReg::operator=(uint32_t val)
+{
+    AlarmTargets[index] = val;
+    sim_timer_hw.armed.bits |= 1u << index;
+    return *this;
+}
+
+SimAlarmReg::operator uint32_t() const
+{
+    return AlarmTargets[index];
+}
+
+int hardware_alarm_claim_unused(bool required)
+{
+    for (uint i=0; i<NUM_TIMERS; ++i)
+    {
+        if (!(ClaimedAlarms & (1u << i)))
+        {
+            ClaimedAlarms |= 1u << i;
+            return int(i);
+        }
+    }
+
+    assert(!required);
+    return -1;
+}
+
+void hardware_alarm_unclaim(uint alarm_num)
+{
+    ClaimedAlarms &= ~(1u << alarm_num);
+}
+
+
+//  hardware/uart.h
+//
+SimUartDataReg& SimUartDataReg::operator=(uint32_t val)
+{
+    SimUart& uart = Uarts[index];
+    assert(uart.txFifo.size() < UartFifoDepth);
+    uart.txFifo.push_back({ NowUs, uint8_t(val) });
+    return *this;
+}
+
+SimUartDataReg::operator uint32_t() const
+{
+    SimUart& uart = Uarts[index];
+    if (uart.rxFifo.empty())
+        return 0;
+
+    const uint32_t val = uart.rxFifo.front();
+    uart.rxFifo.pop_front();
+    return val;
+}
+
+uint uart_init(uart_inst_t*, uint baudrate)
+{
+    return baudrate;
+}
+
+bool uart_is_writable(uart_inst_t* uart)
+{
+    return Uarts[uart->index].txFifo.size() < UartFifoDepth;
+}
+
+bool uart_is_readable(uart_inst_t* uart)
+{
+    return !Uarts[uart->index].rxFifo.empty();
+}
+
+void uart_set_irq_enables(uart_inst_t* uart, bool rx_has_data, bool tx_needs_data)
+{
+    uart->hw.imsc = (rx_has_data ? UART_UARTIMSC_RXIM_BITS : 0) | (tx_needs_data ? UART_UARTIMSC_TXIM_BITS : 0);
+}
+
+void uart_tx_wait_blocking(uart_inst_t* uart)
+{
+    const SimUart& simUart = Uarts[uart->index];
+    while (!simUart.txFifo.empty() || simUart.shifterDoneUs > NowUs)
+        sim::advance_us(MaxStepUs);
+}
+
+void uart_write_blocking(uart_inst_t* uart, const uint8_t* src, size_t len)
+{
+    for (size_t i=0; i<len; ++i)
+    {
+        while (!uart_is_writable(uart))
+            sim::advance_us(MaxStepUs);
+        uart->hw.dr = src[i];
+    }
+}
+
+
+//  hardware/i2c.h
+//
+SimI2cDataCmdReg& SimI2cDataCmdReg::operator=(uint32_t val)
+{
+    if (!NunchukConnected)
+    {
+        sim_i2cs[index].hw.raw_intr_stat |= I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS;
+        return *this;
+    }
+
+    const uint64_t startUs = std::max(I2cBusFreeUs, NowUs);
+    if (val & I2C_IC_DATA_CMD_CMD_BITS)
+    {
+        // a read; the first byte of a transfer also pays for the address
+        const bool firstByte = I2cRxFifo.empty() && I2cStateBytesLeft == 0;
+        const uint64_t readyUs = startUs + (firstByte ? 2 : 1) * I2cByteUs;
+        if (firstByte && NunchukReg == 0)
+            I2cStateBytesLeft = 6;
+
+        I2cRxFifo.push_back({ readyUs, read_nunchuk_reg(NunchukReg) });
+        ++NunchukReg;
+        I2cBusFreeUs = readyUs;
+
+        if (I2cStateBytesLeft && --I2cStateBytesLeft == 0)
+            ++SimStats.stateReads;
+    }
+    else
+    {
+        NunchukReg = uint8_t(val & I2C_IC_DATA_CMD_DAT_BITS);
+        I2cBusFreeUs = startUs + 2 * I2cByteUs;
+    }
+
+    return *this;
+}
+
+SimI2cDataCmdReg::operator uint32_t() const
+{
+    if (I2cRxFifo.empty() || I2cRxFifo.front().readyUs > NowUs)
+        return 0;
+
+    const uint8_t val = I2cRxFifo.front().val;
+    I2cRxFifo.pop_front();
+    return val;
+}
+
+SimI2cEnableReg& SimI2cEnableReg::operator=(uint32_t val)
+{
+    // the controller's own fifos go instantly; a byte already on the wire still finishes
+    i2c_hw_t& hw = sim_i2cs[index].hw;
+    hw.enable_status = val & I2C_IC_ENABLE_STATUS_IC_EN_BITS;
+    if (!hw.enable_status)
+    {
+        I2cRxFifo.clear();
+        I2cStateBytesLeft = 0;
+    }
+    return *this;
+}
+
+SimI2cEnableReg::operator uint32_t() const
+{
+    return sim_i2cs[index].hw.enable_status;
+}
+
+uint i2c_init(i2c_inst_t*, uint baudrate)
+{
+    return baudrate;
+}
+
+size_t i2c_get_read_available(i2c_inst_t*)
+{
+    size_t available = 0;
+    for (const PendingRead& read : I2cRxFifo)
+    {
+        if (read.readyUs > NowUs)
+            break;
+        ++available;
+    }
+    return available;
+}
+
+int i2c_write_blocking(i2c_inst_t*, uint8_t addr, const uint8_t* src, size_t len, bool)
+{
+    if (addr != NunchukAddress || !NunchukConnected)
+        return PICO_ERROR_GENERIC;
+
+    sim::advance_us((len + 1) * I2cByteUs);
+    if (len == 1)
+        NunchukReg = src[0];
+
+    return int(len);
+}
+
+int i2c_read_blocking(i2c_inst_t*, uint8_t addr, uint8_t* dst, size_t len, bool)
+{
+    if (addr != NunchukAddress || !NunchukConnected)
+        return PICO_ERROR_GENERIC;
+
+    sim::advance_us((len + 1) * I2cByteUs);
+    for (size_t i=0; i<len; ++i)
+        dst[i] = read_nunchuk_reg(uint8_t(NunchukReg + i));
+
+    return int(len);
+}
+
+
+//  tusb.h
+//
+bool tusb_init()                        { return true; }
+bool tud_midi_mounted()                 { return UsbConnected; }
+
+bool tud_midi_packet_write(const uint8_t*)
+{
+    if (!UsbConnected || UsbFifo.size() >= UsbFifoDepth)
+        return false;
+
+    UsbFifo.push_back({ NowUs, 0 });
+    return true;
+}
+
+
+//  pico/multicore.h
+//
+void multicore_lockout_victim_init()
+{
+    LockoutVictimReady = true;
+}
+
+void multicore_lockout_start_blocking()
+{
+    // the real one waits for the other core to say it's parked, so without a victim it never returns
+    ++Lockouts;
+    if (!LockoutVictimReady)
+        ++StuckLockouts;
+}
+
+void multicore_lockout_end_blocking()
+{
+}
+
+
+//  hardware/flash.h
+//
+// typical times for the pico's w25q16 (the datasheet maximums are ~10x these); the caller is
+// stalled for the duration, but irqs it left enabled keep running
+constexpr uint64_t FlashSectorEraseUs = 45 * 1000;
+constexpr uint64_t FlashPageProgramUs = 400;
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    assert(flash_offs % FLASH_SECTOR_SIZE == 0 && count % FLASH_SECTOR_SIZE == 0);
+    assert(flash_offs + count <= sizeof(sim_flash));
+    if (!flash_has_power())
+        return;
+    memset(sim_flash + flash_offs, 0xff, count);
+    sim::advance_us(FlashSectorEraseUs * (count / FLASH_SECTOR_SIZE));
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count)
+{
+    assert(flash_offs % FLASH_PAGE_SIZE == 0 && count % FLASH_PAGE_SIZE == 0);
+    assert(flash_offs + count <= sizeof(sim_flash));
+    if (!flash_has_power())
+        return;
+    for (size_t i=0; i<count; ++i)
+        sim_flash[flash_offs + i] &= data[i];
+    sim::advance_us(FlashPageProgramUs * (count / FLASH_PAGE_SIZE));
+}
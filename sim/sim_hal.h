@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// controls for the simulated hardware behind hal/; only the sim's main & the tests use these
+namespace sim {
+
+// one raw nunchuk reading, as it'd come off the wire
+struct NunchukSample
+{
+    uint32_t timeUs = 0;
+    uint8_t  joyX = 128, joyY = 128;
+    uint16_t accelX = 512, accelY = 512, accelZ = 716;
+    bool     btnC = false, btnZ = false;
+
+    bool sameInputsAs(const NunchukSample& other) const;
+};
+
+// a midi byte as it finished leaving the uart
+struct WireByte
+{
+    uint64_t timeUs;
+    uint8_t  val;
+};
+
+// from an input changing in the trace to the next complete message out of a port
+struct Latency
+{
+    uint32_t count = 0;
+    uint64_t totalUs = 0;
+    uint32_t minUs = ~0u;
+    uint32_t maxUs = 0;
+
+    void add(uint32_t us);
+};
+
+struct Stats
+{
+    uint32_t stateReads = 0;        // completed 6 byte nunchuk state reads
+    uint32_t midiMessages = 0;      // complete messages seen on the wire
+    uint32_t usbPackets = 0;        // usb-midi packets read by the host
+
+    Latency wireLatency;
+    Latency usbLatency;
+};
+
+
+uint64_t now_us();
+// moves virtual time on, letting the uart drain and firing any interrupts that are due
+void advance_us(uint64_t us);
+
+// the trace is played back against virtual time, offset so that it starts now; samples must be in time order
+void set_nunchuk_trace(std::vector<NunchukSample> trace);
+void set_nunchuk_connected(bool connected);
+
+// fed to the firmware one char at a time through getchar_timeout_us
+void queue_console_input(const std::string& text);
+bool console_input_pending();
+
+void erase_flash();
+// flash takes this many more page programs or sector erases, then ignores the rest as if the
+// power had gone mid save; negative (the default) never cuts it
+void set_flash_power_cut(int opsLeft);
+// multicore lockouts started, and how many of them nothing had called
+// multicore_lockout_victim_init to answer; on the rp2040 those never return
+uint32_t get_lockouts();
+uint32_t get_stuck_lockouts();
+
+// the host has the usb-midi interface open from the start
+void set_usb_connected(bool connected);
+
+// bytes arriving on the midi uart's rx, back to back at the wire's rate, starting no earlier
+// than atUs and after anything already queued
+void queue_midi_input(const std::vector<uint8_t>& bytes, uint64_t atUs = 0);
+bool midi_input_pending();
+
+const std::vector<WireByte>& get_wire_bytes();
+const Stats& get_stats();
+void reset_stats();
+
+}
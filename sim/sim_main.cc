@@ -0,0 +1,611 @@
+//********************************************************************************
+//  host simulation of the midisister firmware
+//
+// runs the real setup()/loop() against a simulated nunchuk and uart in virtual time,
+// then reports frame rate, midi traffic and input-to-wire latency
+//
+//  usage: midisister_sim [--trace file.csv] [--seconds n] [--config mapping.txt]
+//                        [--loop-us n] [--midi-out file] [--midi-in file] [--before command]...
+//                        [--after command]... [--no-usb] [--verbose]
+//         midisister_sim --bench-parser
+//         midisister_sim --bench-luts [--config mapping.txt]
+//
+// --after sends a console command once the run is over and shows its output, e.g. --after stats
+// --before sends one ahead of the run, once any config's in, e.g. --before "clock start"
+// --midi-in plays bytes into the midi uart's rx; each line is a time in ms from the start of the
+// run (fractions are fine), then hex bytes, e.g. "250 c1 02" (they go out back to back from then)
+// --bench-parser times the midi input parser on this machine against a full rate stream, and exits
+// --bench-luts times the mapping lookup tables against the calibrate & remap path they're built
+// from, over every mapping in the config (or one like the built in one), and exits
+//
+// traces are csv: time_ms,joy_x,joy_y,accel_x,accel_y,accel_z,btn_c,btn_z with raw values
+// (8 bit joystick, 10 bit accel); without one a synthetic trace sweeps every axis at once
+//
+
+#include "sim_hal.h"
+
+#include "config.h"
+#include "mapping_luts.h"
+#include "midi.h"
+#include "midi_parser.h"
+#include "nunchuk.h"
+#include "sample_clock.h"
+#include "usb_midi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+
+void setup();
+void loop(Nunchuk& nchk);
+extern SampleClock sampleClock;
+
+
+namespace {
+
+std::vector<sim::NunchukSample> makeSyntheticTrace(double seconds)
+{
+    // 1kHz, every axis moving at a different rate, a bit of accelerometer noise and
+    // a Z press every half second
+    std::vector<sim::NunchukSample> trace;
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> noise(-2, 2);
+
+    const uint32_t numSamples = uint32_t(seconds * 1000);
+    for (uint32_t ms=0; ms<numSamples; ++ms)
+    {
+        const double t = ms / 1000.0;
+        sim::NunchukSample s;
+        s.timeUs = ms * 1000;
+        s.joyX = uint8_t(128 + 93 * sin(t * 2 * M_PI * 0.7));
+        s.joyY = uint8_t(128 + 93 * sin(t * 2 * M_PI * 1.3));
+        s.accelX = uint16_t(512 + 204 * sin(t * 2 * M_PI * 0.5) + noise(rng));
+        s.accelY = uint16_t(512 + 204 * sin(t * 2 * M_PI * 0.9) + noise(rng));
+        s.accelZ = uint16_t(716 + 100 * sin(t * 2 * M_PI * 0.3) + noise(rng));
+        s.btnZ = (ms % 500) < 100;
+        trace.push_back(s);
+    }
+    return trace;
+}
+
+bool loadTrace(const char* path, std::vector<sim::NunchukSample>& trace)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#' || !isdigit(line[0]))
+            continue;
+
+        for (char& c : line)
+            if (c == ',')
+                c = ' ';
+
+        std::istringstream fields(line);
+        double timeMs;
+        int joyX, joyY, accelX, accelY, accelZ, btnC, btnZ;
+        if (!(fields >> timeMs >> joyX >> joyY >> accelX >> accelY >> accelZ >> btnC >> btnZ))
+            continue;
+
+        sim::NunchukSample s;
+        s.timeUs = uint32_t(timeMs * 1000);
+        s.joyX = uint8_t(joyX);
+        s.joyY = uint8_t(joyY);
+        s.accelX = uint16_t(accelX);
+        s.accelY = uint16_t(accelY);
+        s.accelZ = uint16_t(accelZ);
+        s.btnC = btnC != 0;
+        s.btnZ = btnZ != 0;
+        trace.push_back(s);
+    }
+    return true;
+}
+
+bool loadFile(const char* path, std::string& contents)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    contents = ss.str();
+    return true;
+}
+
+struct MidiInput
+{
+    double timeMs;
+    std::vector<uint8_t> bytes;
+};
+
+bool loadMidiInput(const char* path, std::vector<MidiInput>& input)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        MidiInput entry;
+        if (!(fields >> entry.timeMs))
+            continue;
+
+        std::string hex;
+        while (fields >> hex)
+            entry.bytes.push_back(uint8_t(strtoul(hex.c_str(), nullptr, 16)));
+        input.push_back(std::move(entry));
+    }
+    return true;
+}
+
+
+// a minute of the wire running flat out: ccs & notes under running status, clock bytes landing
+// anywhere (mid-message included), program changes and the odd sysex dump
+std::vector<uint8_t> makeBenchStream(uint32_t& outMessages)
+{
+    constexpr uint32_t WireBytesPerSecond = 1000 * 1000 / MidiByteTimeUs;
+    constexpr uint32_t StreamBytes = 60 * WireBytesPerSecond;
+
+    std::vector<uint8_t> stream;
+    std::mt19937 rng(1234);
+    auto next = [&](uint32_t n) { return uint32_t(rng() % n); };
+    uint8_t runningStatus = 0;
+    uint32_t untilClock = 66;      // 24ppqn at 120bpm is a clock every ~66 bytes
+    outMessages = 0;
+
+    auto push = [&](uint8_t b)
+    {
+        stream.push_back(b);
+        if (--untilClock == 0)
+        {
+            stream.push_back(0xf8);
+            untilClock = 66;
+        }
+    };
+
+    while (stream.size() < StreamBytes)
+    {
+        const uint32_t kind = next(1000);
+        if (kind < 5)
+        {
+            push(0xf0);
+            for (uint32_t i=0, len=64+next(256); i<len; ++i)
+                push(uint8_t(next(128)));
+            push(0xf7);
+            runningStatus = 0;
+            continue;
+        }
+
+        uint8_t status = (kind < 700) ? 0xb0 : (kind < 980) ? 0x90 : 0xc0;
+        status |= uint8_t(next(2));
+        if (status != runningStatus)
+            push(status);
+        runningStatus = status;
+
+        push(uint8_t(next(128)));
+        if ((status & 0xf0) != 0xc0)
+            push(uint8_t(next(128)));
+        ++outMessages;
+    }
+    return stream;
+}
+
+uint32_t BenchMessages = 0;
+uint32_t BenchChecksum = 0;
+
+int benchParser()
+{
+    uint32_t expectedMessages;
+    const std::vector<uint8_t> stream = makeBenchStream(expectedMessages);
+
+    MidiHandlers handlers;
+    handlers.onMessage = [](const MidiMessage& msg) { ++BenchMessages; BenchChecksum += msg.status + msg.data[0] + msg.data[1]; };
+    handlers.onRealtime = [](uint8_t status) { BenchChecksum += status; };
+    handlers.onSysex = [](const uint8_t* data, uint32_t len, uint8_t) { BenchChecksum += len ? data[len - 1] : 0; };
+    MidiParser parser(handlers);
+
+    // the rx queue hands it over in runs of whatever's arrived; cycle through 1..16 byte runs
+    auto parseAll = [&]()
+    {
+        size_t pos = 0;
+        for (uint32_t run=1; pos < stream.size(); run = run % 16 + 1)
+        {
+            const uint32_t len = uint32_t(std::min<size_t>(run, stream.size() - pos));
+            parser.parse(stream.data() + pos, len);
+            pos += len;
+        }
+    };
+
+    parseAll();
+    const MidiParserStats stats = parser.getStats();
+    if (BenchMessages != expectedMessages || stats.strayBytes || stats.truncated)
+    {
+        fprintf(stderr, "parser disagrees with the stream: %u messages of %u, %u stray bytes, %u truncated\n",
+            BenchMessages, expectedMessages, stats.strayBytes, stats.truncated);
+        return 3;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    uint32_t passes = 0;
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+    do
+    {
+        parseAll();
+        ++passes;
+        elapsed = Clock::now() - start;
+    }
+    while (elapsed < std::chrono::seconds(1));
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const double bytes = double(stream.size()) * passes;
+    const double nsPerByte = seconds * 1e9 / bytes;
+    printf("stream:         %zu bytes (60 s of wire at 31250 baud), %u messages, %u realtime, %u sysex bytes\n",
+        stream.size(), expectedMessages, stats.realtime, stats.sysexBytes);
+    printf("parsed:         %u passes in %.2f s; %.1f ns per byte, %.1f MB/s\n", passes, seconds, nsPerByte, bytes / seconds / 1e6);
+    printf("full rate:      %.0fx faster than the wire; %.4f%% of a byte time (%u us) per byte\n",
+        MidiByteTimeUs * 1000.0 / nsPerByte, 100.0 * nsPerByte / (MidiByteTimeUs * 1000.0), uint(MidiByteTimeUs));
+    return (BenchChecksum == 0) ? 4 : 0;
+}
+
+// the same mappings as the firmware's built in config, for when --bench-luts isn't given one
+constexpr const char* BenchLutsConfig =
+    "CHAN 1 ROOT C SCALE 0 2 4 5 7 9 11 OCTAVES 3 6 BPM 100 DIV 0.25 "
+    "MAP ax -1 1 48 100 note MAP jx- cc 16 MAP jx+ cc 19 MAP jy pb MAP ay cc 17 MAP az 1 -1 0 127 cc 18 END.";
+
+uint32_t BenchSink = 0;
+
+int benchLuts(const char* configPath)
+{
+    std::string configText = BenchLutsConfig;
+    if (configPath && !loadFile(configPath, configText))
+    {
+        fprintf(stderr, "couldn't read config %s\n", configPath);
+        return 2;
+    }
+    static Config config;
+    if (!config.parse(configText.c_str()))
+    {
+        fprintf(stderr, "bad config\n");
+        return 2;
+    }
+
+    // the sim's nunchuk calibration; never read over i2c here, as no sample is
+    const byte CalibrationBuf[16] = { 128, 128, 128, 0,  179, 179, 179, 0,  221, 35, 128,  221, 35, 128 };
+    Nunchuk::Calibration cal;
+    cal.setFromBuf(CalibrationBuf);
+    Nunchuk nchk(i2c1);
+    nchk.applyCalibration(cal, 1);
+
+    // every raw value of every axis comes round, each out of step with the others
+    constexpr uint NumSamples = 1024;
+    std::vector<Nunchuk::State> samples(NumSamples);
+    for (uint i=0; i<NumSamples; ++i)
+    {
+        const Nunchuk::RawState raw = { uint8_t(i * 7), uint8_t(i * 13), false, false,
+            uint16_t(i), uint16_t((i * 3) & 1023), uint16_t((i * 5) & 1023) };
+        samples[i].set(raw, cal);
+    }
+
+    static MappingLuts luts;
+    const Mapping* mappings = config.getMappings();
+    const uint numMappings = config.getNumMappings();
+    const Mapping* notesMapping = config.getNotesMapping();
+
+    // a frame's worth of outputs either way, as the loop reads them; both pay for taking the sample
+    auto frameSwitch = [&]()
+    {
+        uint32_t sum = 0;
+        for (uint i=0; i<numMappings; ++i)
+            sum += mappings[i].getVal(nchk);
+        if (notesMapping)
+            sum += config.getMappedNote(nchk);
+        return sum;
+    };
+    auto frameLuts = [&]()
+    {
+        uint32_t sum = 0;
+        for (uint i=0; i<numMappings; ++i)
+            sum += luts.getVal(i, nchk);
+        if (notesMapping)
+            sum += luts.getMappedNote(nchk);
+        return sum;
+    };
+
+    luts.build(config, nchk);
+    for (const Nunchuk::State& sample : samples)
+    {
+        nchk.applySample(sample);
+        for (uint i=0; i<numMappings; ++i)
+        {
+            if (luts.getVal(i, nchk) != mappings[i].getVal(nchk))
+            {
+                fprintf(stderr, "lut disagrees with mapping %u\n", i);
+                return 3;
+            }
+        }
+        if (notesMapping && luts.getMappedNote(nchk) != config.getMappedNote(nchk))
+        {
+            fprintf(stderr, "note lut disagrees\n");
+            return 3;
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto nsPer = [](auto fn, uint32_t itemsPerPass)
+    {
+        uint32_t passes = 0;
+        const Clock::time_point start = Clock::now();
+        Clock::duration elapsed;
+        do
+        {
+            fn();
+            ++passes;
+            elapsed = Clock::now() - start;
+        }
+        while (elapsed < std::chrono::milliseconds(500));
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (double(passes) * itemsPerPass);
+    };
+
+    auto allFrames = [&](auto frame)
+    {
+        return [&, frame]()
+        {
+            for (const Nunchuk::State& sample : samples)
+            {
+                nchk.applySample(sample);
+                BenchSink += frame();
+            }
+        };
+    };
+    const double switchNs = nsPer(allFrames(frameSwitch), NumSamples);
+    const double lutsNs = nsPer(allFrames(frameLuts), NumSamples);
+    const double buildNs = nsPer([&]() { luts.build(config, nchk); }, 1);
+
+    const uint outputs = numMappings + (notesMapping ? 1 : 0);
+    printf("config:         %u mappings%s\n", numMappings, notesMapping ? ", plus the note lookup" : "");
+    printf("switch path:    %.1f ns per frame, %.1f ns per output\n", switchNs, switchNs / outputs);
+    printf("luts:           %.1f ns per frame, %.1f ns per output; %.1fx faster\n", lutsNs, lutsNs / outputs, switchNs / lutsNs);
+    printf("build:          %.1f us, every config or calibration change; pays for itself in %.0f frames\n",
+        buildNs / 1000, buildNs / std::max(switchNs - lutsNs, 0.001));
+    return (BenchSink == 0) ? 4 : 0;
+}
+
+void usage(const char* exe)
+{
+    fprintf(stderr, "USAGE: %s [--trace file.csv] [--seconds n] [--config mapping.txt] [--loop-us n] [--midi-out file] [--midi-in file] [--before command]... [--after command]... [--no-usb] [--verbose]\n", exe);
+    fprintf(stderr, "       %s --bench-parser\n", exe);
+    fprintf(stderr, "       %s --bench-luts [--config mapping.txt]\n", exe);
+    exit(1);
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* tracePath = nullptr;
+    const char* configPath = nullptr;
+    const char* midiOutPath = nullptr;
+    const char* midiInPath = nullptr;
+    double seconds = 10.0;
+    uint32_t loopUs = 5;        // what one pass of loop() costs when there's nothing to do
+    bool verbose = false;
+    bool usbConnected = true;
+    bool benchLutsRequested = false;
+    std::vector<std::string> beforeCommands;
+    std::vector<std::string> afterCommands;
+
+    for (int i=1; i<argc; ++i)
+    {
+        auto nextArg = [&]() -> const char* { if (i + 1 >= argc) usage(argv[0]); return argv[++i]; };
+
+        if (!strcmp(argv[i], "--trace"))            tracePath = nextArg();
+        else if (!strcmp(argv[i], "--seconds"))     seconds = atof(nextArg());
+        else if (!strcmp(argv[i], "--config"))      configPath = nextArg();
+        else if (!strcmp(argv[i], "--loop-us"))     loopUs = uint32_t(atoi(nextArg()));
+        else if (!strcmp(argv[i], "--midi-out"))    midiOutPath = nextArg();
+        else if (!strcmp(argv[i], "--midi-in"))     midiInPath = nextArg();
+        else if (!strcmp(argv[i], "--bench-parser")) return benchParser();
+        else if (!strcmp(argv[i], "--bench-luts"))  benchLutsRequested = true;
+        else if (!strcmp(argv[i], "--before"))      beforeCommands.push_back(nextArg());
+        else if (!strcmp(argv[i], "--after"))       afterCommands.push_back(nextArg());
+        else if (!strcmp(argv[i], "--no-usb"))      usbConnected = false;
+        else if (!strcmp(argv[i], "--verbose"))     verbose = true;
+        else usage(argv[0]);
+    }
+    if (benchLutsRequested)
+        return benchLuts(configPath);
+
+    std::vector<sim::NunchukSample> trace;
+    if (tracePath)
+    {
+        if (!loadTrace(tracePath, trace) || trace.empty())
+        {
+            fprintf(stderr, "couldn't read trace %s\n", tracePath);
+            return 2;
+        }
+        seconds = trace.back().timeUs / 1e6;
+    }
+    else
+    {
+        trace = makeSyntheticTrace(seconds);
+    }
+    std::vector<MidiInput> midiInput;
+    if (midiInPath && !loadMidiInput(midiInPath, midiInput))
+    {
+        fprintf(stderr, "couldn't read midi input %s\n", midiInPath);
+        return 2;
+    }
+    std::string configText;
+    if (configPath)
+    {
+        if (!loadFile(configPath, configText))
+        {
+            fprintf(stderr, "couldn't read config %s\n", configPath);
+            return 2;
+        }
+        // a stray blank line would start the next config, swallowing any --after commands
+        if (configText.empty() || configText.back() != '\n')
+            configText += '\n';
+        sim::queue_console_input(configText);
+    }
+
+    // the firmware talks a lot on stdout; keep the report readable unless asked
+    const int stdoutFd = dup(fileno(stdout));
+    FILE* report = fdopen(dup(stdoutFd), "w");
+    if (!verbose)
+        freopen("/dev/null", "w", stdout);
+
+    sim::erase_flash();
+    sim::set_usb_connected(usbConnected);
+    setup();
+
+    // get through the nunchuk's (blocking) init, its first read, any config and setup's note offs
+    // before anything's measured
+    Nunchuk nchk(i2c1);
+    while (sim::get_stats().stateReads == 0 || sim::console_input_pending() || usb_midi_queued())
+    {
+        loop(nchk);
+        sim::advance_us(loopUs);
+    }
+    // the config's live by now
+    for (const std::string& command : beforeCommands)
+        sim::queue_console_input(command + "\n");
+    while (sim::console_input_pending())
+    {
+        loop(nchk);
+        sim::advance_us(loopUs);
+    }
+
+    sim::set_nunchuk_trace(std::move(trace));
+    for (const MidiInput& entry : midiInput)
+        sim::queue_midi_input(entry.bytes, sim::now_us() + uint64_t(entry.timeMs * 1000));
+    sim::reset_stats();
+    midi_reset_tx_stats();
+    midi_reset_rx_stats();
+    midi_reset_thru_stats();
+    midi_reset_clock_stats();
+    usb_midi_reset_stats();
+    sampleClock.resetStats();
+
+    const uint64_t startUs = sim::now_us();
+    const size_t startWireBytes = sim::get_wire_bytes().size();
+    const uint64_t endUs = startUs + uint64_t(seconds * 1e6);
+
+    while (sim::now_us() < endUs)
+    {
+        loop(nchk);
+        sim::advance_us(loopUs);
+    }
+
+    fflush(stdout);
+
+    const sim::Stats& stats = sim::get_stats();
+    const double simSeconds = (sim::now_us() - startUs) / 1e6;
+    const uint32_t frames = stats.stateReads;
+    const size_t wireBytes = sim::get_wire_bytes().size() - startWireBytes;
+    const MidiTxStats& tx = midi_get_tx_stats();
+
+    fprintf(report, "simulated:      %.2f s\n", simSeconds);
+    fprintf(report, "frames:         %u (%.1f per second)\n", frames, frames / simSeconds);
+    fprintf(report, "midi bytes:     %zu (%.2f per frame, %.1f%% of the wire)\n",
+        wireBytes, frames ? double(wireBytes) / frames : 0.0, 100.0 * wireBytes * MidiByteTimeUs / (simSeconds * 1e6));
+    fprintf(report, "midi messages:  %u\n", stats.midiMessages);
+    fprintf(report, "midi tx:        %u dropped, %u bytes saved by running status, peak queue %uB, longest gap %.2f ms\n",
+        tx.messagesDropped, tx.bytesSaved, tx.peakQueued, tx.maxGapUs / 1000.0);
+    auto printLatency = [&](const char* label, const sim::Latency& latency)
+    {
+        if (latency.count)
+        {
+            fprintf(report, "%s min %.2f ms, mean %.2f ms, max %.2f ms (%u samples)\n", label,
+                latency.minUs / 1000.0, latency.totalUs / 1000.0 / latency.count, latency.maxUs / 1000.0, latency.count);
+        }
+    };
+    printLatency("input->wire:   ", stats.wireLatency);
+
+    // clock out, going by when each tick really left the wire
+    std::vector<uint64_t> tickUs;
+    for (size_t i=startWireBytes; i<sim::get_wire_bytes().size(); ++i)
+    {
+        if (sim::get_wire_bytes()[i].val == 0xf8)
+            tickUs.push_back(sim::get_wire_bytes()[i].timeUs);
+    }
+    if (tickUs.size() > 2)
+    {
+        const double meanIntervalUs = double(tickUs.back() - tickUs.front()) / (tickUs.size() - 1);
+        double maxJitterUs = 0;
+        for (size_t i=1; i<tickUs.size(); ++i)
+            maxJitterUs = std::max(maxJitterUs, fabs(double(tickUs[i] - tickUs[i - 1]) - meanIntervalUs));
+        fprintf(report, "midi clock:     %zu ticks, interval %.1f us (%.2f bpm), jitter max %.1f us\n",
+            tickUs.size(), meanIntervalUs, 60e6 / (meanIntervalUs * MidiClockTicksPerBeat), maxJitterUs);
+    }
+    if (!midiInput.empty())
+    {
+        const MidiRxStats& rx = midi_get_rx_stats();
+        fprintf(report, "midi rx:        %u bytes, %u dropped, %u line errors, peak queue %uB\n",
+            rx.bytesReceived, rx.bytesDropped, rx.lineErrors, rx.peakQueued);
+
+        const MidiThruStats& thru = midi_get_thru_stats();
+        if (thru.messages || thru.sysexBytes)
+        {
+            fprintf(report, "midi thru:      %u messages, %u sysex bytes, %u dropped, %u held behind sysex; queued behind mean %.2f ms, max %.2f ms\n",
+                thru.messages, thru.sysexBytes, thru.dropped, thru.held,
+                thru.messages ? thru.totalAddedUs / 1000.0 / thru.messages : 0.0, thru.maxAddedUs / 1000.0);
+        }
+    }
+    if (usbConnected)
+    {
+        const UsbMidiStats& usb = usb_midi_get_stats();
+        fprintf(report, "usb midi:       %u packets, %u dropped, peak queue %u\n", stats.usbPackets, usb.packetsDropped, usb.peakQueued);
+        printLatency("input->usb:    ", stats.usbLatency);
+    }
+
+    if (midiOutPath)
+    {
+        FILE* out = fopen(midiOutPath, "w");
+        if (!out)
+        {
+            fprintf(stderr, "couldn't write %s\n", midiOutPath);
+            return 2;
+        }
+        for (const sim::WireByte& b : sim::get_wire_bytes())
+            fprintf(out, "%llu %02x\n", (unsigned long long)b.timeUs, b.val);
+        fclose(out);
+    }
+
+    fclose(report);
+
+    if (!afterCommands.empty())
+    {
+        fflush(stdout);
+        dup2(stdoutFd, fileno(stdout));
+        for (const std::string& command : afterCommands)
+        {
+            sim::queue_console_input(command + "\n");
+            for (int i=0; i<100; ++i)
+            {
+                loop(nchk);
+                sim::advance_us(loopUs);
+            }
+        }
+        fflush(stdout);
+    }
+
+    return 0;
+}
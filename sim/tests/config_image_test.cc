@@ -0,0 +1,96 @@
+#include "test.h"
+#include "config.h"
+#include "flash_save.h"
+#include "sim_hal.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+struct MappingFile
+{
+    std::string name;
+    std::string text;
+};
+
+std::vector<MappingFile> loadMappings()
+{
+    std::vector<MappingFile> files;
+    for (const auto& entry : std::filesystem::directory_iterator(MAPPINGS_DIR))
+    {
+        if (entry.path().extension() != ".txt")
+            continue;
+
+        std::ifstream in(entry.path());
+        std::stringstream text;
+        text << in.rdbuf();
+        files.push_back({ entry.path().filename().string(), text.str() });
+    }
+    return files;
+}
+
+// the image is saved & compared byte for byte, padding and all; static storage keeps the padding
+// zeroed, so two configs parsed from the same text are identical
+Config Parsed;
+Config ByLine;
+Config Loaded;
+Config Reparsed;
+
+bool sameImage(const Config& a, const Config& b)
+{
+    return memcmp(&a, &b, sizeof(Config)) == 0;
+}
+
+}
+
+
+TEST(config_image, every_mapping_round_trips)
+{
+    const std::vector<MappingFile> files = loadMappings();
+    CHECK(!files.empty());
+    CHECK(files.size() <= NumPresets);
+
+    sim::erase_flash();
+    for (uint preset=0; preset<files.size() && preset<NumPresets; ++preset)
+    {
+        const MappingFile& file = files[preset];
+        fprintf(stderr, "  %s\n", file.name.c_str());
+        CHECK(Parsed.parse(file.text.c_str()));
+
+        // as the console feeds an upload in, a line at a time
+        ByLine.beginParse();
+        std::istringstream lines(file.text);
+        std::string line;
+        while (std::getline(lines, line))
+            CHECK(ByLine.parseMore(line.c_str()));
+        ByLine.endParse();
+        CHECK(sameImage(ByLine, Parsed));
+
+        CHECK(save_flash_config(Parsed, file.text.c_str(), preset));
+        while (update_flash_save())
+            ;
+
+        CHECK(is_flash_save_valid(preset));
+        CHECK(get_flash_save_data(preset) == file.text);
+        CHECK(load_flash_config(Loaded, preset));
+        CHECK(sameImage(Loaded, Parsed));
+
+        // what a firmware with another image layout would do with it
+        CHECK(Reparsed.parse(get_flash_save_data(preset)));
+        CHECK(sameImage(Reparsed, Parsed));
+    }
+
+    // every preset's still there once the rest have gone in after it
+    for (uint preset=0; preset<files.size() && preset<NumPresets; ++preset)
+    {
+        CHECK(Parsed.parse(files[preset].text.c_str()));
+        CHECK(load_flash_config(Loaded, preset));
+        CHECK(sameImage(Loaded, Parsed));
+    }
+}
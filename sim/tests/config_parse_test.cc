@@ -0,0 +1,72 @@
+#include "test.h"
+#include "config.h"
+
+#include <cstring>
+
+
+namespace {
+
+// the built in config, and one that leans on the decimal & scale parsing
+constexpr const char* BuiltInText = R"END(
+    CHAN 1
+    ROOT C
+    SCALE 0 1 5 7 10
+    OCTAVES 2 7
+    BPM 100
+    DIV 0.25
+
+    MAP ax -1 1 48 100 note
+    MAP jx- cc 16
+    MAP jx+ cc 19
+    MAP jy pb
+    MAP ay cc 17
+    MAP az 1 -1 0 127 cc 18
+
+    END.
+)END";
+
+constexpr const char* OddText =
+    "CHAN 16 ROOT F# SCALE 0 2 3 5 7 8 10 11 OCTAVES 1 9 BPM 133 DIV 0.125 "
+    "MAP jx -0.75 .5 7 120 cc 1 MAP jy 1 -1 0 16383 pb MAP ax+ 0 1.25 36 96 note END.";
+
+constexpr Config BuiltIn = Config::fromText(BuiltInText);
+constexpr Config Odd = Config::fromText(OddText);
+
+// compared byte for byte, padding and all; static storage keeps the padding zeroed
+Config Runtime;
+
+}
+
+
+TEST(config_parse, compile_time_matches_runtime)
+{
+    CHECK(Runtime.parse(BuiltInText));
+    CHECK(memcmp(&Runtime, &BuiltIn, sizeof(Config)) == 0);
+
+    CHECK(Runtime.parse(OddText));
+    CHECK(memcmp(&Runtime, &Odd, sizeof(Config)) == 0);
+}
+
+TEST(config_parse, runtime_rejects_what_the_build_would)
+{
+    // at compile time each of these is a build error; at runtime it's a failed parse
+    CHECK(!Runtime.parse("CHAN 1 MAP jx bogus 5 END."));
+    CHECK(!Runtime.parse("CHAN 1 MAP qq cc 5 END."));
+    CHECK(!Runtime.parse("CHAN 1 ZAP 3 END."));
+    clearError();
+}
+
+TEST(config_parse, division_below_a_tick_is_rejected)
+{
+    CHECK(Runtime.parse("CHAN 1 DIV 0.0416667 END."));
+    CHECK_EQ(Runtime.getAutoRepeatTicks(), 1u);
+
+    // anything finer, or none at all, would leave repeats & arp steps with no time between them
+    CHECK(!Runtime.parse("CHAN 1 DIV 0 END."));
+    CHECK(!Runtime.parse("CHAN 1 DIV -0.5 END."));
+    CHECK(!Runtime.parse("CHAN 1 DIV 0.01 END."));
+    clearError();
+
+    // and a failed parse still leaves timing that works
+    CHECK(Runtime.getStepUsQ8() > 0);
+}
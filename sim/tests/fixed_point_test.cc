@@ -0,0 +1,185 @@
+#include "test.h"
+#include "config.h"
+#include "nunchuk.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+
+// the sensor path was float until it moved to Q15 with Q23 reciprocals; the float versions here
+// are the old path, kept as the reference the fixed point one has to match
+namespace {
+
+struct JoyCal   { uint8_t min, ctr, max; };
+struct AccelCal { uint16_t zeroG, oneG; };
+
+float joyFloat(uint8_t raw, const JoyCal& cal)
+{
+    constexpr float deadzone = 0.1f;
+    if (raw < cal.ctr)
+    {
+        const float fullVal = (cal.ctr - raw) * (1.0f / float(cal.ctr - cal.min));
+        const float val = (fullVal - deadzone) * (1.0f / (1.0f - (2.f * deadzone)));
+        return -1.f * std::clamp(val, 0.f, 1.f);
+    }
+
+    const float fullVal = (raw - cal.ctr) * (1.0f / float(cal.max - cal.ctr));
+    const float val = (fullVal - deadzone) * (1.0f / (1.0f - (2.f * deadzone)));
+    return std::clamp(val, 0.f, 1.f);
+}
+
+float accelFloat(uint16_t raw, const AccelCal& cal)
+{
+    return float(int(raw) - int(cal.zeroG)) * (1.0f / float(int(cal.oneG) - int(cal.zeroG)));
+}
+
+uint16_t remapFloat(float val, float fromLo, float fromHi, uint16_t toLo, uint16_t toHi)
+{
+    if (fabsf(fromHi - fromLo) < 0.001f)
+        return toLo;
+
+    const float normalised = std::clamp((val - fromLo) / (fromHi - fromLo), 0.f, 1.f);
+    const float scaled = normalised * float(toHi - toLo + 1);
+    return uint16_t(std::clamp<int>(int(scaled) + toLo, toLo, toHi));
+}
+
+// as the nunchuk sends it; see Calibration::setFromBuf
+Nunchuk::Calibration makeCalibration(const AccelCal (&accel)[3], const JoyCal& joyX, const JoyCal& joyY)
+{
+    byte buf[16] = {};
+    for (int i=0; i<3; ++i)
+    {
+        buf[i] = byte(accel[i].zeroG >> 2);
+        buf[4 + i] = byte(accel[i].oneG >> 2);
+        buf[3] |= byte((accel[i].zeroG & 3) << (4 - 2*i));
+        buf[7] |= byte((accel[i].oneG & 3) << (4 - 2*i));
+    }
+    buf[8] = joyX.max;  buf[9] = joyX.min;  buf[10] = joyX.ctr;
+    buf[11] = joyY.max; buf[12] = joyY.min; buf[13] = joyY.ctr;
+
+    Nunchuk::Calibration cal;
+    cal.setFromBuf(buf);
+    return cal;
+}
+
+// the sim's nunchuk, one off a real one, and some lopsided & narrow ones
+const JoyCal JoyCals[] = {
+    { 35, 128, 221 },
+    { 28, 131, 226 },
+    { 0, 128, 255 },
+    { 100, 110, 250 },
+    { 5, 240, 250 },
+};
+const AccelCal AccelCals[] = {
+    { 512, 716 },
+    { 508, 722 },
+    { 300, 320 },       // about as little as a real one could move by
+    { 716, 512 },       // upside down
+    { 0, 1023 },
+};
+
+struct Range
+{
+    float fromLo, fromHi;
+    uint16_t toLo, toHi;
+};
+const Range Ranges[] = {
+    { -1.f, 1.f, 0, 127 },
+    { -1.f, 1.f, 0, 16383 },
+    { 0.f, 1.f, 0, 127 },
+    { 1.f, -1.f, 0, 127 },
+    { -0.5f, 0.5f, 48, 100 },
+    { -2.f, 2.f, 0, 16383 },
+    { 0.25f, 0.3f, 0, 127 },
+};
+
+// how far the fixed point value is from the float path's, in Q15 lsbs
+int q15Error(float ref, fixed val)
+{
+    return std::abs(int(std::lround(ref * float(FixedOne))) - int(val));
+}
+
+}
+
+
+TEST(fixed_point, joystick_matches_float)
+{
+    int worst = 0;
+    for (const JoyCal& joy : JoyCals)
+    {
+        const AccelCal accel[3] = { AccelCals[0], AccelCals[0], AccelCals[0] };
+        const Nunchuk::Calibration cal = makeCalibration(accel, joy, joy);
+        for (uint raw=0; raw<256; ++raw)
+        {
+            const float ref = joyFloat(uint8_t(raw), joy);
+            const fixed val = cal.calibrate(Nunchuk::Axis::JoyX, uint16_t(raw));
+            CHECK_EQ(cal.calibrate(Nunchuk::Axis::JoyY, uint16_t(raw)), val);
+            worst = std::max(worst, q15Error(ref, val));
+            CHECK(val >= -FixedOne && val <= FixedOne);
+        }
+    }
+    // truncating the Q23 reciprocal & the shifts down to Q15, then the deadzone's * 1.25
+    CHECK(worst <= 2);
+}
+
+TEST(fixed_point, accel_matches_float)
+{
+    int worst = 0;
+    for (const AccelCal& accelCal : AccelCals)
+    {
+        const AccelCal accel[3] = { accelCal, accelCal, accelCal };
+        const Nunchuk::Calibration cal = makeCalibration(accel, JoyCals[0], JoyCals[0]);
+        for (uint raw=0; raw<1024; ++raw)
+        {
+            const float ref = accelFloat(uint16_t(raw), accelCal);
+            for (Nunchuk::Axis axis : { Nunchuk::Axis::AccelX, Nunchuk::Axis::AccelY, Nunchuk::Axis::AccelZ })
+            {
+                const fixed val = cal.calibrate(axis, uint16_t(raw));
+                worst = std::max(worst, q15Error(ref, val));
+            }
+        }
+    }
+    // the same, without the deadzone, but up to 4g of range
+    CHECK(worst <= 3);
+}
+
+TEST(fixed_point, outputs_match_float)
+{
+    int worst = 0;
+    for (const JoyCal& joy : JoyCals)
+    for (const AccelCal& accelCal : AccelCals)
+    {
+        const AccelCal accel[3] = { accelCal, accelCal, accelCal };
+        const Nunchuk::Calibration cal = makeCalibration(accel, joy, joy);
+        for (const Range& range : Ranges)
+        {
+            Mapping mapping;
+            mapping.fromLo = fixed_from_float(range.fromLo);
+            mapping.fromHi = fixed_from_float(range.fromHi);
+            mapping.toLo = range.toLo;
+            mapping.toHi = range.toHi;
+
+            for (Input input : { Input::JoyX, Input::JoyXNeg, Input::JoyXPos, Input::AccelX })
+            {
+                mapping.input = input;
+                const bool isJoy = (input != Input::AccelX);
+                for (uint raw=0; raw<(isJoy ? 256u : 1024u); ++raw)
+                {
+                    float ref = isJoy ? joyFloat(uint8_t(raw), joy) : accelFloat(uint16_t(raw), accelCal);
+                    if (input == Input::JoyXNeg)
+                        ref = std::max(-ref, 0.f);
+                    else if (input == Input::JoyXPos)
+                        ref = std::max(ref, 0.f);
+
+                    const fixed val = cal.calibrate(isJoy ? Nunchuk::Axis::JoyX : Nunchuk::Axis::AccelX, uint16_t(raw));
+                    const int out = mapping.remap(val);
+                    const int refOut = remapFloat(ref, range.fromLo, range.fromHi, range.toLo, range.toHi);
+                    worst = std::max(worst, std::abs(out - refOut));
+                }
+            }
+        }
+    }
+    // a few Q15 lsbs only ever tip an output over to the next step
+    CHECK(worst <= 1);
+}
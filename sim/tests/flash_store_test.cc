@@ -0,0 +1,309 @@
+#include "test.h"
+#include "flash_store.h"
+#include "sim_hal.h"
+#include "util.h"
+
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "hardware/flash.h"
+}
+#include "pico/multicore.h"
+
+
+namespace {
+
+// well clear of flash_save's region at the top of flash; two sectors a bank, 32 pages each
+constexpr uint32_t RegionOffset = 1024 * 1024;
+constexpr uint32_t RegionSize = 4 * FLASH_SECTOR_SIZE;
+constexpr uint32_t BankSize = RegionSize / 2;
+
+// with their headers, three big records or five small ones fill a bank
+constexpr uint32_t BigRecord = 2400;    // 10 pages
+constexpr uint32_t SmallRecord = 1400;  // 6 pages
+
+constexpr uint16_t KeyA = 1;
+constexpr uint16_t KeyB = 2;
+constexpr uint16_t KeyC = 3;
+
+void eraseRegion()
+{
+    sim::set_flash_power_cut(-1);
+    flash_range_erase(RegionOffset, RegionSize);
+    clearError();
+}
+
+bool put(FlashStore& store, uint16_t key, uint32_t length, byte fill)
+{
+    const std::vector<byte> payload(length, fill);
+    const FlashStore::Chunk chunk = { payload.data(), length };
+    return store.write(key, &chunk, 1);
+}
+
+bool holds(FlashStore& store, uint16_t key, uint32_t length, byte fill)
+{
+    uint32_t foundLength = 0;
+    const byte* found = store.find(key, &foundLength);
+    if (!found || foundLength != length)
+        return false;
+
+    for (uint32_t i=0; i<length; ++i)
+    {
+        if (found[i] != fill)
+            return false;
+    }
+    return true;
+}
+
+bool isErased(uint32_t offset, uint32_t length)
+{
+    for (uint32_t i=0; i<length; ++i)
+    {
+        if (sim_flash[offset + i] != 0xff)
+            return false;
+    }
+    return true;
+}
+
+uint bankOf(FlashStore& store, uint16_t key)
+{
+    return uint(store.find(key) - sim_flash - RegionOffset) / BankSize;
+}
+
+// whether a whole page of the fill made it anywhere into the region
+bool reachedFlash(byte fill)
+{
+    for (uint32_t page=RegionOffset; page<RegionOffset + RegionSize; page+=FLASH_PAGE_SIZE)
+    {
+        uint32_t i = 0;
+        while (i < FLASH_PAGE_SIZE && sim_flash[page + i] == fill)
+            ++i;
+        if (i == FLASH_PAGE_SIZE)
+            return true;
+    }
+    return false;
+}
+
+// each written out in full before the next; only one write can wait its turn
+void putEach(FlashStore& store, std::initializer_list<std::pair<uint16_t, byte>> records, uint32_t length)
+{
+    for (const auto& [key, fill] : records)
+    {
+        put(store, key, length, fill);
+        store.flush();
+    }
+}
+
+// a, b & c, then a twice more; that's the first bank full, so the next write collects
+void fillFirstBank(FlashStore& store)
+{
+    putEach(store, { { KeyA, 'a' }, { KeyB, 'b' }, { KeyC, 'c' }, { KeyA, 'd' }, { KeyA, 'e' } }, SmallRecord);
+}
+
+}
+
+
+TEST(flash_store, torn_write_keeps_previous_copy)
+{
+    eraseRegion();
+    {
+        FlashStore store(RegionOffset, RegionSize);
+        CHECK(put(store, KeyA, BigRecord, 'a'));
+        store.flush();
+
+        // every page but the header goes down, then the power goes
+        sim::set_flash_power_cut(9);
+        CHECK(put(store, KeyA, BigRecord, 'b'));
+        store.flush();
+        sim::set_flash_power_cut(-1);
+        CHECK(reachedFlash('b'));
+        // the second record starts straight after the first's ten pages
+        CHECK(isErased(RegionOffset + 10 * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE));
+    }
+
+    FlashStore rebooted(RegionOffset, RegionSize);
+    CHECK(holds(rebooted, KeyA, BigRecord, 'a'));
+
+    // the next write steps over what's left of the torn one
+    CHECK(put(rebooted, KeyA, BigRecord, 'c'));
+    rebooted.flush();
+    CHECK(holds(rebooted, KeyA, BigRecord, 'c'));
+
+    FlashStore again(RegionOffset, RegionSize);
+    CHECK(holds(again, KeyA, BigRecord, 'c'));
+
+    // a flipped bit fails the crc, and the copy before is used instead
+    byte* payload = const_cast<byte*>(again.find(KeyA));
+    payload[100] ^= 1;
+    FlashStore corrupted(RegionOffset, RegionSize);
+    CHECK(holds(corrupted, KeyA, BigRecord, 'a'));
+    payload[100] ^= 1;
+    CHECK(!hasErrorHappened());
+}
+
+TEST(flash_store, mount_resumes_interrupted_collect)
+{
+    eraseRegion();
+    {
+        FlashStore store(RegionOffset, RegionSize);
+        fillFirstBank(store);
+
+        // the second bank's already erased, so the collect goes straight to carrying records
+        // over; a's six pages make it and the power goes before any of b
+        sim::set_flash_power_cut(6);
+        CHECK(put(store, KeyA, SmallRecord, 'f'));
+        store.flush();
+        sim::set_flash_power_cut(-1);
+    }
+
+    // the staged write is lost, but mount carries b & c over before anything else can happen
+    FlashStore rebooted(RegionOffset, RegionSize);
+    rebooted.mount();
+    CHECK(!rebooted.isBusy());
+    CHECK_EQ(bankOf(rebooted, KeyA), 1u);
+    CHECK_EQ(bankOf(rebooted, KeyB), 1u);
+    CHECK_EQ(bankOf(rebooted, KeyC), 1u);
+    CHECK(holds(rebooted, KeyA, SmallRecord, 'e'));
+    CHECK(holds(rebooted, KeyB, SmallRecord, 'b'));
+    CHECK(holds(rebooted, KeyC, SmallRecord, 'c'));
+
+    // so the next collect, which erases the first bank, loses nothing
+    putEach(rebooted, { { KeyA, 'g' }, { KeyA, 'h' }, { KeyA, 'i' } }, SmallRecord);
+    CHECK_EQ(bankOf(rebooted, KeyA), 0u);
+    CHECK(holds(rebooted, KeyA, SmallRecord, 'i'));
+    CHECK(holds(rebooted, KeyB, SmallRecord, 'b'));
+    CHECK(holds(rebooted, KeyC, SmallRecord, 'c'));
+    CHECK(!hasErrorHappened());
+}
+
+TEST(flash_store, boot_mount_leaves_other_core_alone)
+{
+    eraseRegion();
+    {
+        FlashStore store(RegionOffset, RegionSize);
+        fillFirstBank(store);
+
+        sim::set_flash_power_cut(6);
+        CHECK(put(store, KeyA, SmallRecord, 'f'));
+        store.flush();
+        sim::set_flash_power_cut(-1);
+    }
+
+    // at boot the other core hasn't been launched, so carrying b & c over mustn't wait on it
+    const uint32_t lockouts = sim::get_lockouts();
+    FlashStore rebooted(RegionOffset, RegionSize);
+    rebooted.mount();
+    CHECK_EQ(bankOf(rebooted, KeyB), 1u);
+    CHECK_EQ(bankOf(rebooted, KeyC), 1u);
+    CHECK_EQ(sim::get_lockouts(), lockouts);
+
+    // once it's up, every step parks it
+    multicore_lockout_victim_init();
+    rebooted.setOtherCoreRunning(true);
+    CHECK(put(rebooted, KeyA, SmallRecord, 'g'));
+    rebooted.flush();
+    CHECK_EQ(sim::get_lockouts(), lockouts + 6);
+    CHECK_EQ(sim::get_stuck_lockouts(), 0u);
+    CHECK(holds(rebooted, KeyA, SmallRecord, 'g'));
+    CHECK(!hasErrorHappened());
+}
+
+TEST(flash_store, refuses_collect_that_would_lose_records)
+{
+    eraseRegion();
+    {
+        FlashStore store(RegionOffset, RegionSize);
+        putEach(store, { { KeyA, 'a' }, { KeyB, 'b' }, { KeyC, 'c' } }, BigRecord);
+
+        // collect; a is carried over, then the power goes with b all but down
+        sim::set_flash_power_cut(10 + 9);
+        CHECK(put(store, KeyA, BigRecord, 'd'));
+        store.flush();
+        sim::set_flash_power_cut(-1);
+    }
+
+    // b is carried over again past the torn copy, which leaves no room for c. a collect would
+    // erase c's only copy, so it's left where it is
+    FlashStore rebooted(RegionOffset, RegionSize);
+    rebooted.mount();
+    CHECK(hasErrorHappened());
+    CHECK_EQ(bankOf(rebooted, KeyB), 1u);
+    CHECK_EQ(bankOf(rebooted, KeyC), 0u);
+
+    // and every write after is refused rather than collecting
+    clearError();
+    CHECK(!put(rebooted, KeyA, BigRecord, 'e'));
+    CHECK(hasErrorHappened());
+    CHECK(!rebooted.isBusy());
+
+    CHECK(holds(rebooted, KeyA, BigRecord, 'a'));
+    CHECK(holds(rebooted, KeyB, BigRecord, 'b'));
+    CHECK(holds(rebooted, KeyC, BigRecord, 'c'));
+
+    FlashStore again(RegionOffset, RegionSize);
+    CHECK(holds(again, KeyC, BigRecord, 'c'));
+    clearError();
+}
+
+TEST(flash_store, newer_write_supersedes_staged_one)
+{
+    eraseRegion();
+    FlashStore store(RegionOffset, RegionSize);
+    fillFirstBank(store);
+
+    // this one's staged behind the collect...
+    CHECK(put(store, KeyA, SmallRecord, 'f'));
+    CHECK(store.isBusy());
+    // ...so this just replaces it, without waiting
+    CHECK(put(store, KeyA, SmallRecord, 'g'));
+    CHECK(store.isBusy());
+    CHECK_EQ(bankOf(store, KeyA), 0u);
+
+    // a different record can't wait behind it as well, so it's turned away rather than blocking
+    CHECK(!put(store, KeyB, SmallRecord, 'h'));
+    CHECK(!hasErrorHappened());
+    store.flush();
+    CHECK(holds(store, KeyA, SmallRecord, 'g'));
+    CHECK(holds(store, KeyB, SmallRecord, 'b'));
+    CHECK(!reachedFlash('f'));
+    CHECK(!reachedFlash('h'));
+
+    FlashStore rebooted(RegionOffset, RegionSize);
+    CHECK(holds(rebooted, KeyA, SmallRecord, 'g'));
+    CHECK(holds(rebooted, KeyB, SmallRecord, 'b'));
+    CHECK(holds(rebooted, KeyC, SmallRecord, 'c'));
+    CHECK(!hasErrorHappened());
+}
+
+TEST(flash_store, write_waits_behind_one_in_progress)
+{
+    eraseRegion();
+    FlashStore store(RegionOffset, RegionSize);
+    CHECK(put(store, KeyA, BigRecord, 'a'));
+    CHECK(store.update());
+
+    // a's only a page in, and b is staged behind it without holding anything up
+    CHECK(put(store, KeyB, BigRecord, 'b'));
+    CHECK(!store.find(KeyA));
+    CHECK(!store.find(KeyB));
+
+    // a newer b replaces it, but c has to come back once b's started
+    CHECK(put(store, KeyB, BigRecord, 'c'));
+    CHECK(!put(store, KeyC, BigRecord, 'd'));
+    for (int page=0; page<9; ++page)
+        CHECK(store.update());
+    CHECK(holds(store, KeyA, BigRecord, 'a'));
+    CHECK(store.isBusy());
+    CHECK(put(store, KeyC, BigRecord, 'd'));
+    store.flush();
+
+    // each was written from its own copy, even with the next one staged alongside
+    FlashStore rebooted(RegionOffset, RegionSize);
+    CHECK(holds(rebooted, KeyA, BigRecord, 'a'));
+    CHECK(holds(rebooted, KeyB, BigRecord, 'c'));
+    CHECK(holds(rebooted, KeyC, BigRecord, 'd'));
+    CHECK(!reachedFlash('b'));
+    CHECK(!hasErrorHappened());
+}
@@ -0,0 +1,155 @@
+#include "test.h"
+#include "midi_parser.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+// everything the handlers see, in order: "90 3c 64" for a message, "rt f8" for realtime, and
+// "sx 01 02" for a sysex piece, with [ & ] for the first & last and ! when aborted
+std::vector<std::string> Events;
+
+void appendByte(std::string& event, uint8_t b)
+{
+    char hex[4];
+    snprintf(hex, sizeof(hex), " %02x", b);
+    event += hex;
+}
+
+void onMessage(const MidiMessage& msg)
+{
+    std::string event;
+    appendByte(event, msg.status);
+    for (uint8_t i=0; i<msg.length; ++i)
+        appendByte(event, msg.data[i]);
+    Events.push_back(event.substr(1));
+}
+
+void onRealtime(uint8_t status)
+{
+    std::string event = "rt";
+    appendByte(event, status);
+    Events.push_back(event);
+}
+
+void onSysex(const uint8_t* data, uint32_t len, uint8_t flags)
+{
+    std::string event = (flags & MidiSysex_Start) ? "sx[" : "sx";
+    for (uint32_t i=0; i<len; ++i)
+        appendByte(event, data[i]);
+    if (flags & MidiSysex_Aborted)
+        event += '!';
+    if (flags & MidiSysex_End)
+        event += ']';
+    Events.push_back(event);
+}
+
+MidiParser makeParser()
+{
+    MidiHandlers handlers;
+    handlers.onMessage = onMessage;
+    handlers.onRealtime = onRealtime;
+    handlers.onSysex = onSysex;
+
+    Events.clear();
+    return MidiParser(handlers);
+}
+
+using Expected = std::vector<std::string>;
+
+void parse(MidiParser& parser, std::initializer_list<uint8_t> bytes)
+{
+    parser.parse(bytes.begin(), uint32_t(bytes.size()));
+}
+
+}
+
+
+TEST(midi_parser, running_status_and_system_common)
+{
+    MidiParser parser = makeParser();
+    parse(parser, { 0x90, 60, 100, 61, 101, 0xc0, 5, 6 });
+    CHECK(Events == Expected({ "90 3c 64", "90 3d 65", "c0 05", "c0 06" }));
+
+    // a system common message ends running status, so the last byte has nothing to go with
+    Events.clear();
+    parse(parser, { 0xf2, 1, 2, 0xf6, 0x40 });
+    CHECK(Events == Expected({ "f2 01 02", "f6" }));
+    CHECK_EQ(parser.getStats().messages, 6u);
+    CHECK_EQ(parser.getStats().strayBytes, 1u);
+}
+
+TEST(midi_parser, any_sized_pieces)
+{
+    const std::vector<uint8_t> stream = { 0xb0, 1, 2, 3, 0xf8, 4, 0xe5, 0, 0x40, 0xf3, 7 };
+
+    MidiParser whole = makeParser();
+    whole.parse(stream.data(), uint32_t(stream.size()));
+    const std::vector<std::string> expected = Events;
+    CHECK(expected == Expected({ "b0 01 02", "rt f8", "b0 03 04", "e5 00 40", "f3 07" }));
+
+    MidiParser byByte = makeParser();
+    for (uint8_t b : stream)
+        byByte.parse(&b, 1);
+    CHECK(Events == expected);
+}
+
+TEST(midi_parser, realtime_anywhere)
+{
+    MidiParser parser = makeParser();
+    parse(parser, { 0x90, 0xf8, 60, 0xfa, 100 });
+    CHECK(Events == Expected({ "rt f8", "rt fa", "90 3c 64" }));
+    CHECK_EQ(parser.getStats().realtime, 2u);
+    CHECK_EQ(parser.getStats().truncated, 0u);
+
+    // and it splits a sysex around it, without ending it
+    Events.clear();
+    parse(parser, { 0xf0, 1, 2, 0xf8, 3, 0xf7 });
+    CHECK(Events == Expected({ "sx[ 01 02", "rt f8", "sx 03]" }));
+}
+
+TEST(midi_parser, split_sysex)
+{
+    MidiParser parser = makeParser();
+    parse(parser, { 0xf0, 0x7e, 1 });
+    parse(parser, { 2, 3 });
+    parse(parser, { 0xf7, 0x90, 60, 100 });
+    CHECK(Events == Expected({ "sx[ 7e 01", "sx 02 03", "sx]", "90 3c 64" }));
+    CHECK_EQ(parser.getStats().sysexBytes, 4u);
+    CHECK_EQ(parser.getStats().truncated, 0u);
+}
+
+TEST(midi_parser, aborted_sysex)
+{
+    MidiParser parser = makeParser();
+    parse(parser, { 0xf0, 1, 2, 0x90, 60, 100 });
+    CHECK(Events == Expected({ "sx[ 01 02!]", "90 3c 64" }));
+    CHECK_EQ(parser.getStats().truncated, 1u);
+
+    // losing the input part way through ends it too
+    Events.clear();
+    parse(parser, { 0xf0, 1 });
+    parser.reset();
+    CHECK(Events == Expected({ "sx[ 01", "sx!]" }));
+    CHECK_EQ(parser.getStats().truncated, 2u);
+}
+
+TEST(midi_parser, stray_bytes)
+{
+    MidiParser parser = makeParser();
+
+    // data with no status, a lone f7, and data after the undefined system commons
+    parse(parser, { 1, 2, 0xf7, 3, 0xf4, 4, 0xf5 });
+    CHECK(Events.empty());
+    CHECK_EQ(parser.getStats().strayBytes, 5u);
+
+    // a message cut short by another status
+    parse(parser, { 0x90, 60, 0xb0, 1, 2 });
+    CHECK(Events == Expected({ "b0 01 02" }));
+    CHECK_EQ(parser.getStats().truncated, 1u);
+    CHECK_EQ(parser.getStats().messages, 1u);
+}
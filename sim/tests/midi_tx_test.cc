@@ -0,0 +1,314 @@
+#include "test.h"
+#include "midi.h"
+#include "midi_parser.h"
+#include "midi_scheduler.h"
+#include "sim_hal.h"
+#include "usb_midi.h"
+
+#include <vector>
+
+
+namespace {
+
+// din only (unless asked otherwise) and no running status, so every message goes out on the
+// wire exactly as queued
+void startMidi(uint8_t ports = MidiPort_Din)
+{
+    static bool started = false;
+    if (!started)
+    {
+        midi_init(uart0, 16, 17);
+        started = true;
+    }
+    midi_set_ports(ports);
+    midi_set_running_status(false);
+    midi_flush();
+    midi_reset_tx_stats();
+    usb_midi_reset_stats();
+}
+
+// the sim's host reads a frame's worth of packets every ms
+void drainUsb()
+{
+    while (usb_midi_queued())
+    {
+        usb_midi_update();
+        sim::advance_us(1000);
+    }
+}
+
+std::vector<uint8_t> wireBytesSince(size_t start)
+{
+    std::vector<uint8_t> bytes;
+    const std::vector<sim::WireByte>& wire = sim::get_wire_bytes();
+    for (size_t i=start; i<wire.size(); ++i)
+        bytes.push_back(wire[i].val);
+    return bytes;
+}
+
+void appendCc(std::vector<uint8_t>& bytes, uint8_t cc, uint8_t val)
+{
+    bytes.insert(bytes.end(), { 0xb0, cc, val });
+}
+
+// what one pass of the scheduler puts on the wire
+std::vector<uint8_t> scheduled(MidiScheduler& scheduler)
+{
+    const size_t wireStart = sim::get_wire_bytes().size();
+    scheduler.update();
+    midi_flush();
+    return wireBytesSince(wireStart);
+}
+
+}
+
+
+TEST(midi_tx, empty)
+{
+    startMidi();
+    const size_t wireStart = sim::get_wire_bytes().size();
+
+    CHECK_EQ(midi_tx_queued(), 0u);
+    sim::advance_us(MidiByteTimeUs);
+    CHECK_EQ(midi_tx_backlog_us(), 0u);
+
+    // nothing to wait for, and nothing turns up on the wire
+    const uint64_t startUs = sim::now_us();
+    midi_flush();
+    CHECK_EQ(sim::now_us(), startUs);
+    CHECK_EQ(sim::get_wire_bytes().size(), wireStart);
+    CHECK_EQ(midi_get_tx_stats().bytesSent, 0u);
+}
+
+TEST(midi_tx, full_queue_drops_whole_messages)
+{
+    startMidi();
+    const size_t wireStart = sim::get_wire_bytes().size();
+
+    // time stands still, so nothing drains beyond what the uart's fifo takes straight away
+    std::vector<uint8_t> expected;
+    uint32_t accepted = 0;
+    while (midi_cc(0, uint8_t(accepted & 0x7f), uint8_t((accepted >> 7) & 0x7f)))
+    {
+        appendCc(expected, uint8_t(accepted & 0x7f), uint8_t((accepted >> 7) & 0x7f));
+        ++accepted;
+    }
+    CHECK_EQ(midi_get_tx_stats().messagesDropped, 1u);
+    CHECK(midi_tx_queued() > 512u - 3u);
+    CHECK(midi_tx_queued() <= 512u);
+    CHECK_EQ(midi_get_tx_stats().peakQueued, midi_tx_queued());
+
+    // every further one's counted, and none of them get half queued
+    CHECK(!midi_note_on(0, 60));
+    CHECK(!midi_cc(0, 1, 2));
+    CHECK_EQ(midi_get_tx_stats().messagesDropped, 3u);
+    CHECK_EQ(midi_get_tx_stats().bytesQueued, accepted * 3);
+
+    midi_flush();
+    CHECK(wireBytesSince(wireStart) == expected);
+    CHECK_EQ(midi_get_tx_stats().bytesSent, accepted * 3);
+
+    // and once it's drained there's room again
+    CHECK(midi_cc(0, 1, 2));
+    midi_flush();
+    CHECK_EQ(midi_get_tx_stats().messagesDropped, 3u);
+}
+
+TEST(midi_tx, wraparound)
+{
+    startMidi();
+    const size_t wireStart = sim::get_wire_bytes().size();
+
+    // 6000 bytes through a 512 byte queue; it goes round a dozen times, with the queue's end
+    // falling in the middle of messages as often as not
+    std::vector<uint8_t> expected;
+    for (uint32_t i=0; i<2000; ++i)
+    {
+        while (midi_tx_queued() > 400)
+            sim::advance_us(MidiByteTimeUs);
+
+        const uint8_t cc = uint8_t(i % 120);
+        const uint8_t val = uint8_t((i / 120) & 0x7f);
+        CHECK(midi_cc(0, cc, val));
+        appendCc(expected, cc, val);
+    }
+    midi_flush();
+
+    CHECK(wireBytesSince(wireStart) == expected);
+    CHECK_EQ(midi_get_tx_stats().messagesDropped, 0u);
+    CHECK_EQ(midi_get_tx_stats().bytesSent, uint32_t(expected.size()));
+    CHECK_EQ(midi_tx_queued(), 0u);
+}
+
+TEST(midi_tx, each_port_gets_its_own_copy)
+{
+    for (uint8_t ports : { MidiPort_Din, MidiPort_Usb, MidiPort_All })
+    {
+        startMidi(ports);
+        const size_t wireStart = sim::get_wire_bytes().size();
+
+        CHECK(midi_cc(0, 1, 2));
+        CHECK(midi_note_on(3, 60, 100));
+        midi_flush();
+        drainUsb();
+
+        const std::vector<uint8_t> expected = { 0xb0, 1, 2, 0x93, 60, 100 };
+        CHECK((ports & MidiPort_Din) ? wireBytesSince(wireStart) == expected : wireBytesSince(wireStart).empty());
+        const uint32_t usbPackets = (ports & MidiPort_Usb) ? 2 : 0;
+        CHECK_EQ(usb_midi_get_stats().packetsQueued, usbPackets);
+        CHECK_EQ(usb_midi_get_stats().packetsSent, usbPackets);
+    }
+    startMidi();
+}
+
+TEST(midi_tx, usb_keeps_its_status_under_running_status)
+{
+    startMidi(MidiPort_All);
+    midi_set_running_status(true);
+    const size_t wireStart = sim::get_wire_bytes().size();
+
+    CHECK(midi_cc(0, 1, 2));
+    CHECK(midi_cc(0, 1, 3));
+    midi_flush();
+    drainUsb();
+
+    // the second status is elided on din, but every usb packet carries its own
+    CHECK(wireBytesSince(wireStart) == std::vector<uint8_t>({ 0xb0, 1, 2, 1, 3 }));
+    CHECK_EQ(usb_midi_get_stats().packetsQueued, 2u);
+    CHECK_EQ(usb_midi_get_stats().packetsSent, 2u);
+    startMidi();
+}
+
+TEST(midi_tx, unplugged_usb)
+{
+    sim::set_usb_connected(false);
+
+    // usb alone has nowhere to send it
+    startMidi(MidiPort_Usb);
+    CHECK(!midi_cc(0, 1, 2));
+    CHECK_EQ(usb_midi_get_stats().packetsUnplugged, 1u);
+    CHECK_EQ(usb_midi_queued(), 0u);
+
+    // din doesn't care
+    startMidi(MidiPort_All);
+    const size_t wireStart = sim::get_wire_bytes().size();
+    CHECK(midi_cc(0, 1, 2));
+    midi_flush();
+    CHECK(wireBytesSince(wireStart) == std::vector<uint8_t>({ 0xb0, 1, 2 }));
+    CHECK_EQ(usb_midi_get_stats().packetsUnplugged, 1u);
+    CHECK_EQ(usb_midi_queued(), 0u);
+
+    sim::set_usb_connected(true);
+    startMidi();
+}
+
+TEST(midi_tx, usb_only_gets_what_din_queued)
+{
+    startMidi(MidiPort_All);
+
+    // with time standing still din fills up first; whatever it drops, usb doesn't get either
+    uint32_t accepted = 0;
+    while (midi_cc(0, uint8_t(accepted & 0x7f), 0))
+        ++accepted;
+    CHECK(!midi_cc(0, 1, 2));
+    CHECK_EQ(midi_get_tx_stats().messagesDropped, 2u);
+    CHECK_EQ(usb_midi_get_stats().packetsQueued + usb_midi_get_stats().packetsDropped, accepted);
+
+    midi_flush();
+    drainUsb();
+    startMidi();
+}
+
+TEST(midi_tx, cc14_sends_only_the_halves_that_changed)
+{
+    startMidi();
+    MidiScheduler scheduler;
+
+    // msb on cc 7, lsb on cc 39
+    scheduler.controlChange14(0, 7, (36 << 7) | 52);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 0xb0, 7, 36, 0xb0, 39, 52 }));
+
+    scheduler.controlChange14(0, 7, (36 << 7) | 53);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 0xb0, 39, 53 }));
+
+    // a new msb zeroes the receiver's lsb, so an lsb of 0 doesn't need sending
+    scheduler.controlChange14(0, 7, 37 << 7);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 0xb0, 7, 37 }));
+    scheduler.controlChange14(0, 7, (38 << 7) | 1);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 0xb0, 7, 38, 0xb0, 39, 1 }));
+
+    scheduler.controlChange14(0, 7, (38 << 7) | 1);
+    CHECK(scheduled(scheduler).empty());
+}
+
+TEST(midi_tx, nrpn_selects_its_parameter_once)
+{
+    startMidi();
+    midi_set_running_status(true);
+    MidiScheduler scheduler;
+
+    // select nrpn 0x123 on cc 99/98, then data entry on cc 6/38; all on one status
+    scheduler.nrpn(1, 0x123, 64 << 7);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 0xb1, 99, 0x02, 98, 0x23, 6, 64 }));
+
+    // still selected, so just the data; the status is still running from the last pass
+    scheduler.nrpn(1, 0x123, (64 << 7) | 1);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 38, 1 }));
+
+    // another parameter is selected, and gets its data in full
+    scheduler.nrpn(1, 5, (64 << 7) | 1);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 99, 0, 98, 5, 6, 64, 38, 1 }));
+
+    // and back again
+    scheduler.nrpn(1, 0x123, (64 << 7) | 2);
+    CHECK(scheduled(scheduler) == std::vector<uint8_t>({ 99, 0x02, 98, 0x23, 6, 64, 38, 2 }));
+    startMidi();
+}
+
+namespace {
+
+// each clock the parser hands over, and the time taken for it; 0 => there wasn't one
+std::vector<uint32_t> RxClockTimes;
+
+void takeClockTime(uint8_t status)
+{
+    uint32_t tickUs = 0;
+    if (status == 0xf8 && !midi_rx_take_clock_time(tickUs))
+        tickUs = 0;
+    RxClockTimes.push_back(tickUs);
+}
+
+}
+
+TEST(midi_tx, rx_drops_a_clock_along_with_its_time)
+{
+    startMidi();
+    midi_reset_rx_stats();
+    MidiHandlers handlers;
+    handlers.onRealtime = takeClockTime;
+    MidiParser parser(handlers);
+
+    // more clocks than there's room to timestamp, with nothing taking them meanwhile
+    sim::queue_midi_input(std::vector<uint8_t>(40, 0xf8));
+    while (sim::midi_input_pending())
+        sim::advance_us(MidiByteTimeUs);
+
+    // the ones that didn't get a time don't get through either, so none's paired up with another's
+    RxClockTimes.clear();
+    midi_rx_update(parser);
+    CHECK_EQ(RxClockTimes.size(), 32u);
+    CHECK_EQ(midi_get_rx_stats().bytesDropped, 8u);
+    CHECK(RxClockTimes[0] != 0);
+    for (size_t i=1; i<RxClockTimes.size(); ++i)
+        CHECK(RxClockTimes[i] != 0 && int32_t(RxClockTimes[i] - RxClockTimes[i - 1]) >= 0);
+
+    // and there's room again once they're taken
+    const uint32_t sentUs = uint32_t(sim::now_us());
+    sim::queue_midi_input({ 0xf8 });
+    while (sim::midi_input_pending())
+        sim::advance_us(MidiByteTimeUs);
+    RxClockTimes.clear();
+    midi_rx_update(parser);
+    CHECK_EQ(RxClockTimes.size(), 1u);
+    CHECK(RxClockTimes[0] > sentUs);
+}
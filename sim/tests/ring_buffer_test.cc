@@ -0,0 +1,95 @@
+#include "test.h"
+#include "ring_buffer.h"
+
+
+TEST(ring_buffer, empty)
+{
+    RingBuffer<int, 4> q;
+    CHECK(q.empty());
+    CHECK(!q.full());
+    CHECK_EQ(q.size(), 0u);
+    CHECK_EQ(q.space(), 4u);
+
+    int val = 7;
+    CHECK(!q.pop(val));
+    CHECK_EQ(val, 7);
+
+    const int* run = nullptr;
+    CHECK_EQ(q.peekContiguous(run), 0u);
+
+    // clearing an empty queue leaves it empty
+    q.clear();
+    CHECK(q.empty());
+    CHECK(!q.pop(val));
+}
+
+TEST(ring_buffer, full)
+{
+    RingBuffer<int, 4> q;
+    for (int i=0; i<4; ++i)
+        CHECK(q.push(i));
+    CHECK(q.full());
+    CHECK_EQ(q.space(), 0u);
+    CHECK(!q.push(4));
+
+    // all or nothing; a block that doesn't fit leaves the queue as it was
+    int val = 0;
+    CHECK(q.pop(val));
+    CHECK_EQ(val, 0);
+    const int block[2] = { 10, 11 };
+    CHECK(!q.push(block, 2));
+    CHECK_EQ(q.size(), 3u);
+    CHECK(q.push(block, 1));
+    CHECK(q.full());
+
+    for (int expected : { 1, 2, 3, 10 })
+    {
+        CHECK(q.pop(val));
+        CHECK_EQ(val, expected);
+    }
+    CHECK(q.empty());
+}
+
+TEST(ring_buffer, wraparound)
+{
+    RingBuffer<int, 8> q;
+    int next = 0;
+    int expected = 0;
+
+    // odd sized batches so the read & write positions land everywhere relative to the end
+    for (int round=0; round<100; ++round)
+    {
+        const int count = 1 + (round % 7);
+        for (int i=0; i<count; ++i)
+            CHECK(q.push(next++));
+        CHECK_EQ(q.size(), uint32_t(count));
+
+        int val;
+        for (int i=0; i<count; ++i)
+        {
+            CHECK(q.pop(val));
+            CHECK_EQ(val, expected++);
+        }
+        CHECK(q.empty());
+    }
+
+    // a block pushed across the end comes out in order, and reads in place as two runs
+    RingBuffer<int, 8> block;
+    for (int i=0; i<6; ++i)
+        CHECK(block.push(i));
+    block.clear();
+    const int vals[5] = { 20, 21, 22, 23, 24 };
+    CHECK(block.push(vals, 5));
+
+    const int* run = nullptr;
+    CHECK_EQ(block.peekContiguous(run), 2u);
+    CHECK_EQ(run[0], 20);
+    CHECK_EQ(run[1], 21);
+    block.drop(2);
+
+    CHECK_EQ(block.peekContiguous(run), 3u);
+    CHECK_EQ(run[0], 22);
+    CHECK_EQ(run[2], 24);
+    block.drop(3);
+    CHECK(block.empty());
+}
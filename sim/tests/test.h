@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+
+// just enough of a test framework for the host build. each TEST registers itself, and
+// midisister_tests runs the suites named on its command line (or every suite, given none)
+namespace test {
+
+using TestFn = void (*)();
+
+struct Registrar
+{
+    Registrar(const char* suite, const char* name, TestFn fn);
+};
+
+// a failed check doesn't stop the test, so one run shows everything that's wrong
+void fail(const char* file, int line, const char* what);
+void failEq(const char* file, int line, const char* a, const char* b, long long valA, long long valB);
+
+}
+
+
+#define TEST(suite, name) \
+    static void test_##suite##_##name(); \
+    static test::Registrar registrar_##suite##_##name(#suite, #name, test_##suite##_##name); \
+    static void test_##suite##_##name()
+
+#define CHECK(cond) \
+    do { if (!(cond)) test::fail(__FILE__, __LINE__, #cond); } while (0)
+
+// for integers; both sides are shown when they differ
+#define CHECK_EQ(a, b) \
+    do { \
+        const auto checkA = (a); \
+        const auto checkB = (b); \
+        if (!(checkA == checkB)) \
+            test::failEq(__FILE__, __LINE__, #a, #b, (long long)checkA, (long long)checkB); \
+    } while (0)
@@ -0,0 +1,85 @@
+#include "test.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+
+namespace {
+
+struct Test
+{
+    const char* suite;
+    const char* name;
+    test::TestFn fn;
+};
+
+// registrars run before main, in whatever order the linker likes, so this can't be a plain global
+std::vector<Test>& registry()
+{
+    static std::vector<Test> tests;
+    return tests;
+}
+
+uint32_t Failures = 0;
+
+}
+
+
+namespace test {
+
+Registrar::Registrar(const char* suite, const char* name, TestFn fn)
+{
+    registry().push_back({ suite, name, fn });
+}
+
+void fail(const char* file, int line, const char* what)
+{
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    ++Failures;
+}
+
+void failEq(const char* file, int line, const char* a, const char* b, long long valA, long long valB)
+{
+    fprintf(stderr, "%s:%d: check failed: %s == %s (%lld vs %lld)\n", file, line, a, b, valA, valB);
+    ++Failures;
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    // the firmware talks a lot on stdout; the results go to stderr
+    if (!freopen("/dev/null", "w", stdout))
+        return 2;
+
+    uint32_t ran = 0;
+    uint32_t failedTests = 0;
+    for (const Test& t : registry())
+    {
+        bool wanted = (argc < 2);
+        for (int i=1; i<argc; ++i)
+            wanted |= !strcmp(argv[i], t.suite);
+        if (!wanted)
+            continue;
+
+        const uint32_t failuresBefore = Failures;
+        t.fn();
+        ++ran;
+
+        const bool passed = (Failures == failuresBefore);
+        if (!passed)
+            ++failedTests;
+        fprintf(stderr, "%-8s %s.%s\n", passed ? "ok" : "FAILED", t.suite, t.name);
+    }
+
+    if (!ran)
+    {
+        fprintf(stderr, "no tests matched\n");
+        return 2;
+    }
+
+    fprintf(stderr, "%u of %u tests passed\n", ran - failedTests, ran);
+    return failedTests ? 1 : 0;
+}
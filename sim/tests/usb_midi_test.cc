@@ -0,0 +1,80 @@
+#include "test.h"
+#include "usb_midi.h"
+
+#include <cstring>
+#include <initializer_list>
+
+
+namespace {
+
+// what the packet should be, padding and all; anything packetise refuses leaves out untouched
+bool packetisesTo(uint8_t cable, std::initializer_list<uint8_t> message, uint8_t header, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+    UsbMidiPacket out = {};
+    if (!usb_midi_packetise(cable, message.begin(), uint32_t(message.size()), out))
+        return false;
+    return out.header == header && out.midi[0] == b0 && out.midi[1] == b1 && out.midi[2] == b2;
+}
+
+bool refuses(std::initializer_list<uint8_t> message)
+{
+    UsbMidiPacket out;
+    memset(&out, 0xaa, sizeof(out));
+    const bool packetised = usb_midi_packetise(0, message.begin(), uint32_t(message.size()), out);
+    return !packetised && out.header == 0xaa && out.midi[0] == 0xaa && out.midi[1] == 0xaa && out.midi[2] == 0xaa;
+}
+
+}
+
+
+TEST(usb_midi, channel_voice)
+{
+    // the status nibble is the code index
+    CHECK(packetisesTo(0, { 0x80, 60, 0 }, 0x08, 0x80, 60, 0));
+    CHECK(packetisesTo(0, { 0x91, 60, 100 }, 0x09, 0x91, 60, 100));
+    CHECK(packetisesTo(0, { 0xa2, 60, 50 }, 0x0a, 0xa2, 60, 50));
+    CHECK(packetisesTo(0, { 0xb3, 1, 127 }, 0x0b, 0xb3, 1, 127));
+    CHECK(packetisesTo(0, { 0xef, 0x00, 0x40 }, 0x0e, 0xef, 0x00, 0x40));
+
+    // program change & channel pressure are two bytes, zero padded
+    CHECK(packetisesTo(0, { 0xc4, 5 }, 0x0c, 0xc4, 5, 0));
+    CHECK(packetisesTo(0, { 0xd5, 90 }, 0x0d, 0xd5, 90, 0));
+}
+
+TEST(usb_midi, system_common_and_realtime)
+{
+    CHECK(packetisesTo(0, { 0xf1, 0x23 }, 0x02, 0xf1, 0x23, 0));
+    CHECK(packetisesTo(0, { 0xf2, 0x10, 0x02 }, 0x03, 0xf2, 0x10, 0x02));
+    CHECK(packetisesTo(0, { 0xf3, 7 }, 0x02, 0xf3, 7, 0));
+    CHECK(packetisesTo(0, { 0xf6 }, 0x05, 0xf6, 0, 0));
+
+    for (uint8_t status : { 0xf8, 0xfa, 0xfb, 0xfc, 0xfe, 0xff })
+        CHECK(packetisesTo(0, { status }, 0x0f, status, 0, 0));
+}
+
+TEST(usb_midi, cable_number)
+{
+    CHECK(packetisesTo(1, { 0x90, 60, 100 }, 0x19, 0x90, 60, 100));
+    CHECK(packetisesTo(15, { 0xf8 }, 0xff, 0xf8, 0, 0));
+}
+
+TEST(usb_midi, refuses_what_doesnt_fit)
+{
+    // sysex, and the undefined system commons
+    CHECK(refuses({ 0xf0, 0x7e, 0xf7 }));
+    CHECK(refuses({ 0xf7 }));
+    CHECK(refuses({ 0xf4 }));
+    CHECK(refuses({ 0xf5 }));
+
+    // no status byte, ie. running status; or nothing at all
+    CHECK(refuses({ 60, 100 }));
+    CHECK(refuses({}));
+
+    // the wrong length for the status
+    CHECK(refuses({ 0x90, 60 }));
+    CHECK(refuses({ 0xb0, 1, 2, 3 }));
+    CHECK(refuses({ 0xc0, 5, 0 }));
+    CHECK(refuses({ 0xf2, 0x10 }));
+    CHECK(refuses({ 0xf6, 0 }));
+    CHECK(refuses({ 0xf8, 0xf8 }));
+}